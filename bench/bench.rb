@@ -0,0 +1,200 @@
+# frozen_string_literal: true
+
+# Compresses and decompresses a generated corpus a few times with bczip (and gzip, when it's
+# installed, as a reference), prints MB/s, ratio and peak RSS per file and for the whole corpus,
+# and writes the same numbers as JSON, so that two commits can be compared with a diff.
+
+require 'fileutils'
+require 'json'
+require 'optparse'
+
+Dir.chdir File.join(__dir__, '..')
+EXEC = 'target/bczip'
+BENCH_DIR = 'target/bench'
+
+options = { runs: 3, size: 1 << 20, level: nil, json: "#{BENCH_DIR}/results.json", gzip: true }
+OptionParser.new do |parser|
+  parser.banner = 'Usage: ruby bench/bench.rb [OPTION]...'
+  parser.on('-n', '--runs=N', Integer, 'runs of every command, the median is reported (3)') { |x| options[:runs] = x }
+  parser.on('-s', '--size=BYTES', Integer, 'size of every corpus file (1048576)') { |x| options[:size] = x }
+  parser.on('-l', '--level=N', Integer, 'compression level of both tools (their default)') { |x| options[:level] = x }
+  parser.on('-o', '--json=FILE', "where the JSON results go (#{options[:json]})") { |x| options[:json] = x }
+  parser.on('--no-gzip', 'skip the gzip reference') { options[:gzip] = false }
+end.parse!
+
+# ================================================================================ corpus
+
+WORDS = %w[alpha bravo charlie delta echo foxtrot golf hotel india juliet kilo lima mike november
+           oscar papa quebec romeo sierra tango uniform victor whiskey xray yankee zulu].freeze
+
+def generate_logs(random, size)
+  levels = %w[INFO INFO INFO DEBUG WARN ERROR]
+  paths = %w[/api/v1/items /api/v1/users /api/v2/orders /static/app.js /health]
+  lines = []
+  length = 0
+  time = 1_700_000_000_000
+  while length < size
+    time += random.rand(50)
+    line = format("%<time>d %<level>-5s [worker-%<worker>d] GET %<path>s/%<id>d %<status>d %<ms>dms\n",
+                  time: time, level: levels[random.rand(levels.size)], worker: random.rand(8),
+                  path: paths[random.rand(paths.size)], id: random.rand(10_000),
+                  status: random.rand(10).zero? ? 404 : 200, ms: random.rand(300))
+    lines << line
+    length += line.size
+  end
+  lines.join
+end
+
+def generate_json(random, size)
+  items = []
+  length = 2
+  while length < size
+    item = JSON.generate(id: items.size, name: "#{WORDS[random.rand(WORDS.size)]}-#{random.rand(1000)}",
+                         active: random.rand(2).zero?, score: (random.rand * 100).round(3),
+                         tags: Array.new(random.rand(4)) { WORDS[random.rand(WORDS.size)] })
+    items << item
+    length += item.size + 2
+  end
+  "[\n#{items.join(",\n")}\n]\n"
+end
+
+def generate_csv(random, size)
+  rows = ["id,date,city,quantity,price,total\n"]
+  length = rows.first.size
+  while length < size
+    quantity = random.rand(1..20)
+    price = random.rand(100..9999)
+    row = format("%<id>d,2024-%<month>02d-%<day>02d,%<city>s,%<quantity>d,%<price>.2f,%<total>.2f\n",
+                 id: rows.size, month: random.rand(1..12), day: random.rand(1..28),
+                 city: WORDS[random.rand(WORDS.size)], quantity: quantity, price: price / 100.0,
+                 total: quantity * price / 100.0)
+    rows << row
+    length += row.size
+  end
+  rows.join
+end
+
+# mostly zeros with a few records of telemetry here and there
+def generate_sparse(random, size)
+  data = "\0".b * size
+  offset = 0
+  while (offset += random.rand(64..4096)) + 16 <= size
+    data[offset, 16] = [offset, random.rand(1 << 16), random.rand(1 << 16), 0x55AA].pack('VvvV') + "\0" * 4
+  end
+  data
+end
+
+def generate_random(random, size)
+  random.bytes(size)
+end
+
+# little-endian 32-bit integers going up by small steps
+def generate_sorted(random, size)
+  value = 0
+  Array.new(size / 4) { value += random.rand(16) }.pack('V*')
+end
+
+CORPUS = {
+  'logs.txt' => :generate_logs,
+  'data.json' => :generate_json,
+  'table.csv' => :generate_csv,
+  'sparse.bin' => :generate_sparse,
+  'random.bin' => :generate_random,
+  'sorted.bin' => :generate_sorted
+}.freeze
+
+# the same seed and size always give the same files, which are only generated once
+def corpus_files(size)
+  directory = "#{BENCH_DIR}/corpus-#{size}"
+  FileUtils.mkdir_p(directory)
+
+  CORPUS.each_with_index.map do |(name, generator), i|
+    path = "#{directory}/#{name}"
+    File.binwrite(path, send(generator, Random.new(i + 1), size)[0, size]) unless File.exist?(path)
+    path
+  end
+end
+
+# ================================================================================ measurements
+
+MEASURE = 'target/measure'
+
+# runs a command through the measure helper and returns its wall time in seconds and its
+# peak RSS in KB, which the helper prints on the last line of stderr
+def measure(command, input, output)
+  reader, writer = IO.pipe
+  pid = spawn(MEASURE, *command, in: input, out: output, err: writer)
+  writer.close
+  report = reader.read
+  reader.close
+
+  Process.wait(pid)
+  raise "#{command.join(' ')} failed: #{report}" unless $?.success?
+
+  time, rss = report.lines.last.split
+  [time.to_f, rss.to_i]
+end
+
+def median(values)
+  sorted = values.sort
+  (sorted[(sorted.size - 1) / 2] + sorted[sorted.size / 2]) / 2.0
+end
+
+def benchmark(tool, command, path, runs)
+  compressed = "#{BENCH_DIR}/#{File.basename(path)}.#{tool}"
+  decompressed = "#{compressed}.out"
+  size = File.size(path)
+
+  compress = Array.new(runs) { measure(command, path, compressed) }
+  decompress = Array.new(runs) { measure(command + ['-d'], compressed, decompressed) }
+  raise "#{tool} didn't restore #{path}" unless FileUtils.compare_file(path, decompressed)
+
+  compressed_size = File.size(compressed)
+  FileUtils.rm_f([compressed, decompressed])
+
+  report(File.basename(path), tool, size, compressed_size, median(compress.map(&:first)),
+         median(decompress.map(&:first)), compress.map(&:last).max, decompress.map(&:last).max)
+end
+
+# the slowest levels take seconds per MB, hence the hundredths of MB/s
+def report(file, tool, size, compressed_size, compress_s, decompress_s, compress_rss, decompress_rss)
+  {
+    file: file, tool: tool, size: size, compressed_size: compressed_size,
+    ratio: (size.to_f / compressed_size).round(2),
+    compress_s: compress_s.round(3), decompress_s: decompress_s.round(3),
+    compress_mb_s: (size / 1e6 / compress_s).round(2),
+    decompress_mb_s: (size / 1e6 / decompress_s).round(2),
+    compress_peak_rss_kb: compress_rss,
+    decompress_peak_rss_kb: decompress_rss
+  }
+end
+
+# the whole corpus of a tool, as if it were a single file
+def total(tool, results)
+  report('total', tool, results.sum { |r| r[:size] }, results.sum { |r| r[:compressed_size] },
+         results.sum { |r| r[:compress_s] }, results.sum { |r| r[:decompress_s] },
+         results.map { |r| r[:compress_peak_rss_kb] }.max, results.map { |r| r[:decompress_peak_rss_kb] }.max)
+end
+
+# ================================================================================ report
+
+tools = { 'bczip' => [EXEC, '-c'] }
+tools['gzip'] = %w[gzip -c] if options[:gzip] && system('gzip --version', out: File::NULL, err: File::NULL)
+tools.each_value { |command| command << "-#{options[:level]}" } if options[:level]
+
+results = corpus_files(options[:size]).flat_map do |path|
+  tools.map { |tool, command| benchmark(tool, command, path, options[:runs]) }
+end
+totals = results.group_by { |r| r[:tool] }.map { |tool, tool_results| total(tool, tool_results) }
+
+puts format('%-12s %-6s %10s %10s %7s %10s %10s %9s %9s', 'file', 'tool', 'size', 'compressed', 'ratio',
+            'c MB/s', 'd MB/s', 'c RSS KB', 'd RSS KB')
+(results + totals).each do |r|
+  puts format('%-12s %-6s %10d %10d %7.2f %10.2f %10.2f %9d %9d', r[:file], r[:tool], r[:size],
+              r[:compressed_size], r[:ratio], r[:compress_mb_s], r[:decompress_mb_s],
+              r[:compress_peak_rss_kb], r[:decompress_peak_rss_kb])
+end
+
+File.write(options[:json], JSON.pretty_generate(runs: options[:runs], size: options[:size],
+                                                level: options[:level], results: results, totals: totals) + "\n")
+puts "results written to #{options[:json]}"
@@ -0,0 +1,34 @@
+#include <stdio.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+// Runs a command and prints its wall time in seconds and its peak RSS in KB. The peak RSS of
+// a process counts the one of the process it was forked from, so the benchmark doesn't fork
+// the commands from ruby but from this one, which stays small.
+int main(int argc, char *argv[])
+{
+  if (argc < 2) {
+    fprintf(stderr, "Usage: measure COMMAND [ARGUMENT]...\n");
+    return 2;
+  }
+
+  struct timespec start, end;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+
+  const pid_t pid = fork();
+  if (!pid) {
+    execvp(argv[1], argv + 1);
+    perror(argv[1]);
+    _exit(127);
+  }
+
+  int status;
+  struct rusage usage;
+  wait4(pid, &status, 0, &usage);
+  clock_gettime(CLOCK_MONOTONIC, &end);
+
+  fprintf(stderr, "%.6f %ld\n", (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9, usage.ru_maxrss);
+  return WIFEXITED(status) ? WEXITSTATUS(status) : 1;
+}
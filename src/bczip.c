@@ -0,0 +1,271 @@
+#define _GNU_SOURCE // fopencookie
+#include "bczip.h"
+#include "types.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct thread_pool_t thread_pool;
+extern thread_pool *create_thread_pool(u32 threads_count);
+extern void delete_thread_pool(thread_pool *pool);
+
+typedef struct compressor_t compressor;
+extern compressor *create_compressor(const bczip_compress_settings *settings, thread_pool *pool);
+extern void compress(compressor *compressor, FILE *input, FILE *output);
+extern void delete_compressor(compressor *compressor);
+extern void get_compress_stats(const compressor *compressor, bczip_compress_stats *stats);
+extern void set_compressor_dictionary(compressor *compressor, const bczip_dictionary *dictionary);
+extern const char *check_name(u32 check);
+extern const char *token_name(u32 token);
+
+typedef struct decompressor_t decompressor;
+extern decompressor *create_decompressor(u32 threads_count, thread_pool *pool);
+extern bool decompress(decompressor *decompressor, FILE *input, FILE *output);
+extern bool decompress_range(decompressor *decompressor, FILE *input, FILE *output, u64 start, u64 length);
+extern void delete_decompressor(decompressor *decompressor);
+extern void get_decompress_stats(const decompressor *decompressor, bczip_decompress_stats *stats);
+extern void set_decompressor_dictionary(decompressor *decompressor, const bczip_dictionary *dictionary);
+extern u32 input_dictionary_id(FILE *input);
+
+extern u8 *train_dictionary(const u8 *samples, const usize *sample_sizes, u32 samples_count, usize *dictionary_size);
+extern bczip_dictionary *create_dictionary(const u8 *data, usize size);
+extern void delete_dictionary(bczip_dictionary *dictionary);
+extern u32 dictionary_id(const bczip_dictionary *dictionary);
+
+typedef struct bczip_ctx_t {
+  bczip_compress_settings settings;
+  thread_pool *pool;
+  compressor *compressor;
+  decompressor *decompressor;
+} bczip_ctx;
+
+typedef struct stream_callbacks_t {
+  bczip_read_function read;
+  bczip_write_function write;
+  void *user_data;
+} stream_callbacks;
+
+typedef struct memory_stream_t {
+  const u8 *input;
+  usize input_size;
+  usize input_offset;
+
+  u8 *output;
+  usize output_size;
+  usize output_capacity;
+} memory_stream;
+
+// ================================================================================ external functions
+
+bczip_ctx *bczip_create_ctx(const bczip_compress_settings *settings);
+void bczip_delete_ctx(bczip_ctx *ctx);
+
+void bczip_compress_file(bczip_ctx *ctx, FILE *input, FILE *output);
+void bczip_compress_stream(bczip_ctx *ctx, bczip_read_function read, bczip_write_function write, void *user_data);
+u8 *bczip_compress_buffer(bczip_ctx *ctx, const u8 *input, usize input_size, usize *output_size);
+void bczip_get_compress_stats(const bczip_ctx *ctx, bczip_compress_stats *stats);
+void bczip_get_decompress_stats(const bczip_ctx *ctx, bczip_decompress_stats *stats);
+const char *bczip_check_name(u32 check);
+const char *bczip_token_name(u32 token);
+
+bool bczip_decompress_file(bczip_ctx *ctx, FILE *input, FILE *output);
+bool bczip_decompress_stream(bczip_ctx *ctx, bczip_read_function read, bczip_write_function write, void *user_data);
+u8 *bczip_decompress_buffer(bczip_ctx *ctx, const u8 *input, usize input_size, usize *output_size);
+
+bool bczip_decompress_range(bczip_ctx *ctx, FILE *input, FILE *output, u64 start, u64 length);
+
+u8 *bczip_train_dictionary(const u8 *samples, const usize *sample_sizes, u32 samples_count, usize *dictionary_size);
+bczip_dictionary *bczip_load_dictionary(const u8 *data, usize size);
+void bczip_delete_dictionary(bczip_dictionary *dictionary);
+u32 bczip_dictionary_id(const bczip_dictionary *dictionary);
+void bczip_set_dictionary(bczip_ctx *ctx, const bczip_dictionary *dictionary);
+u32 bczip_get_dictionary_id(FILE *input);
+
+// ================================================================================ internal functions
+
+static ssize_t stream_callbacks_read(void *callbacks, char *data, size_t size);
+static ssize_t stream_callbacks_write(void *callbacks, const char *data, size_t size);
+static FILE *open_stream(stream_callbacks *callbacks, const char *mode);
+
+static usize memory_stream_read(void *stream, u8 *data, usize size);
+static usize memory_stream_write(void *stream, const u8 *data, usize size);
+
+// ================================================================================ definitions
+
+bczip_ctx *bczip_create_ctx(const bczip_compress_settings *settings)
+{
+  bczip_ctx *const ctx = calloc(1, sizeof(bczip_ctx));
+  ctx->settings = *settings;
+
+  ctx->pool = create_thread_pool(settings->threads_count);
+  ctx->compressor = create_compressor(&ctx->settings, ctx->pool);
+  ctx->decompressor = create_decompressor(settings->threads_count, ctx->pool);
+
+  return ctx;
+}
+
+void bczip_delete_ctx(bczip_ctx *ctx)
+{
+  delete_decompressor(ctx->decompressor);
+  delete_compressor(ctx->compressor);
+  delete_thread_pool(ctx->pool);
+  free(ctx);
+}
+
+ssize_t stream_callbacks_read(void *callbacks, char *data, size_t size)
+{
+  const stream_callbacks *const c = callbacks;
+  return c->read(c->user_data, (u8 *)data, size);
+}
+
+ssize_t stream_callbacks_write(void *callbacks, const char *data, size_t size)
+{
+  const stream_callbacks *const c = callbacks;
+  return c->write(c->user_data, (const u8 *)data, size);
+}
+
+// callbacks are wrapped in a FILE that can't seek, so everything goes through the
+// forward-only paths
+FILE *open_stream(stream_callbacks *callbacks, const char *mode)
+{
+  const cookie_io_functions_t functions = {stream_callbacks_read, stream_callbacks_write, NULL, NULL};
+  return fopencookie(callbacks, mode, functions);
+}
+
+usize memory_stream_read(void *stream, u8 *data, usize size)
+{
+  memory_stream *const s = stream;
+  if (size > s->input_size - s->input_offset) { size = s->input_size - s->input_offset; }
+
+  memcpy(data, s->input + s->input_offset, size);
+  s->input_offset += size;
+  return size;
+}
+
+usize memory_stream_write(void *stream, const u8 *data, usize size)
+{
+  memory_stream *const s = stream;
+  if (s->output_size + size > s->output_capacity) {
+    while (s->output_size + size > s->output_capacity) {
+      s->output_capacity *= 2;
+    }
+
+    s->output = realloc(s->output, s->output_capacity * sizeof(u8));
+  }
+
+  memcpy(s->output + s->output_size, data, size);
+  s->output_size += size;
+  return size;
+}
+
+void bczip_compress_file(bczip_ctx *ctx, FILE *input, FILE *output)
+{
+  compress(ctx->compressor, input, output);
+}
+
+void bczip_compress_stream(bczip_ctx *ctx, bczip_read_function read, bczip_write_function write, void *user_data)
+{
+  stream_callbacks callbacks = {read, write, user_data};
+  FILE *const input = open_stream(&callbacks, "rb");
+  FILE *const output = open_stream(&callbacks, "wb");
+
+  compress(ctx->compressor, input, output);
+
+  fclose(output);
+  fclose(input);
+}
+
+u8 *bczip_compress_buffer(bczip_ctx *ctx, const u8 *input, usize input_size, usize *output_size)
+{
+  memory_stream stream = {input, input_size, 0, malloc(256 * sizeof(u8)), 0, 256};
+  bczip_compress_stream(ctx, memory_stream_read, memory_stream_write, &stream);
+
+  *output_size = stream.output_size;
+  return stream.output;
+}
+
+void bczip_get_compress_stats(const bczip_ctx *ctx, bczip_compress_stats *stats)
+{
+  get_compress_stats(ctx->compressor, stats);
+}
+
+void bczip_get_decompress_stats(const bczip_ctx *ctx, bczip_decompress_stats *stats)
+{
+  get_decompress_stats(ctx->decompressor, stats);
+}
+
+const char *bczip_check_name(u32 check)
+{
+  return check_name(check);
+}
+
+const char *bczip_token_name(u32 token)
+{
+  return token_name(token);
+}
+
+bool bczip_decompress_file(bczip_ctx *ctx, FILE *input, FILE *output)
+{
+  return decompress(ctx->decompressor, input, output);
+}
+
+bool bczip_decompress_stream(bczip_ctx *ctx, bczip_read_function read, bczip_write_function write, void *user_data)
+{
+  stream_callbacks callbacks = {read, write, user_data};
+  FILE *const input = open_stream(&callbacks, "rb");
+  FILE *const output = open_stream(&callbacks, "wb");
+
+  const bool valid = decompress(ctx->decompressor, input, output);
+
+  fclose(output);
+  fclose(input);
+  return valid;
+}
+
+u8 *bczip_decompress_buffer(bczip_ctx *ctx, const u8 *input, usize input_size, usize *output_size)
+{
+  memory_stream stream = {input, input_size, 0, malloc(256 * sizeof(u8)), 0, 256};
+  if (!bczip_decompress_stream(ctx, memory_stream_read, memory_stream_write, &stream)) {
+    free(stream.output);
+    return NULL;
+  }
+
+  *output_size = stream.output_size;
+  return stream.output;
+}
+
+bool bczip_decompress_range(bczip_ctx *ctx, FILE *input, FILE *output, u64 start, u64 length)
+{
+  return decompress_range(ctx->decompressor, input, output, start, length);
+}
+
+u8 *bczip_train_dictionary(const u8 *samples, const usize *sample_sizes, u32 samples_count, usize *dictionary_size)
+{
+  return train_dictionary(samples, sample_sizes, samples_count, dictionary_size);
+}
+
+bczip_dictionary *bczip_load_dictionary(const u8 *data, usize size)
+{
+  return create_dictionary(data, size);
+}
+
+void bczip_delete_dictionary(bczip_dictionary *dictionary)
+{
+  delete_dictionary(dictionary);
+}
+
+u32 bczip_dictionary_id(const bczip_dictionary *dictionary)
+{
+  return dictionary_id(dictionary);
+}
+
+void bczip_set_dictionary(bczip_ctx *ctx, const bczip_dictionary *dictionary)
+{
+  set_compressor_dictionary(ctx->compressor, dictionary);
+  set_decompressor_dictionary(ctx->decompressor, dictionary);
+}
+
+u32 bczip_get_dictionary_id(FILE *input)
+{
+  return input_dictionary_id(input);
+}
@@ -0,0 +1,139 @@
+#ifndef BCZIP_H
+#define BCZIP_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// only the library's own functions are visible outside of its shared object
+#define BCZIP_API __attribute__((visibility("default")))
+
+// back-references reach at most 2^window_log bytes back
+#define BCZIP_WINDOW_LOG_MIN 10
+#define BCZIP_WINDOW_LOG_MAX 24
+#define BCZIP_WINDOW_LOG_DEFAULT 20
+
+// inputs longer than a block are split into blocks of 2^block_log bytes, compressed independently
+#define BCZIP_BLOCK_LOG_MIN 16
+#define BCZIP_BLOCK_LOG_MAX 30
+#define BCZIP_BLOCK_LOG_DEFAULT 20
+
+#define BCZIP_THREADS_MAX 256
+
+// levels go from the fastest compression to the smallest output, 0 stands for the default one
+#define BCZIP_LEVEL_MIN 1
+#define BCZIP_LEVEL_MAX 9
+#define BCZIP_LEVEL_DEFAULT 6
+
+// the checks looking for tokens, see bczip_check_name
+#define BCZIP_CHECKS_COUNT 15
+
+// the kinds of tokens: one for every function number, from skip to jumping segment, and one
+// for back-references, see bczip_token_name
+#define BCZIP_TOKENS_COUNT 17
+
+typedef struct bczip_compress_settings_t {
+  uint8_t window_log;
+  uint8_t block_log;
+  uint32_t threads_count;
+  uint8_t level;
+} bczip_compress_settings;
+
+typedef struct bczip_token_stats_t {
+  uint64_t checks_count;  // times its check ran, compression only
+  uint64_t count;         // tokens in the output
+  uint64_t covered_bytes; // decompressed bytes they stand for
+  uint64_t emitted_bytes; // compressed bytes they take before entropy coding, compression only
+} bczip_token_stats;
+
+// What the last compression on a context spent its time on, summed over its blocks. The input
+// is parsed in segments and a check that doesn't pay off in a segment is skipped in the next
+// ones, until it's tried again every now and then; the segments counts tell how often every
+// check was tried. The work of both outputs of a level with an alternative is counted, the
+// tokens and the dictionary only of the output kept.
+typedef struct bczip_compress_stats_t {
+  uint64_t segments_count;
+  uint64_t check_segments_count[BCZIP_CHECKS_COUNT];
+  bczip_token_stats tokens[BCZIP_TOKENS_COUNT];
+
+  double dictionary_seconds; // creating the dictionary
+  double parse_seconds;      // parsing the input into tokens
+  double optimize_seconds;   // compressing the dictionary items and ordering them by use
+  double write_seconds;      // writing the dictionary and the tokens
+  double entropy_seconds;    // splitting and entropy coding them
+
+  // the items found in the input, and those used often enough to be written
+  uint64_t dictionary_items_count;
+  uint64_t dictionary_bytes;
+  uint64_t written_dictionary_items_count;
+  uint64_t written_dictionary_bytes;
+
+  // the dictionaries and tokens of the streams split in sections, and the sections they took
+  uint64_t entropy_input_bytes;
+  uint64_t entropy_output_bytes;
+} bczip_compress_stats;
+
+// what the last decompression on a context spent its time on, summed over its blocks
+typedef struct bczip_decompress_stats_t {
+  bczip_token_stats tokens[BCZIP_TOKENS_COUNT];
+
+  double dictionary_seconds; // decoding the dictionary
+  double entropy_seconds;    // decoding the sections of split streams
+  double tokens_seconds;     // decoding the tokens
+} bczip_decompress_stats;
+
+// A context owns everything (de)compression works with: its thread pool and the buffers of
+// its blocks, which are kept from one call to the next. Calls on one context must not overlap,
+// separate contexts can be used in parallel.
+typedef struct bczip_ctx_t bczip_ctx;
+
+// A dictionary made from samples of inputs alike, for small inputs that have too little in them
+// to find one of their own; it must be given to decompress what it compressed.
+typedef struct bczip_dictionary_t bczip_dictionary;
+
+// reads at most 'size' bytes into 'data' and returns how many were read, zero at the end
+typedef size_t (*bczip_read_function)(void *user_data, uint8_t *data, size_t size);
+// writes 'size' bytes from 'data' and returns how many were written
+typedef size_t (*bczip_write_function)(void *user_data, const uint8_t *data, size_t size);
+
+BCZIP_API bczip_ctx *bczip_create_ctx(const bczip_compress_settings *settings);
+BCZIP_API void bczip_delete_ctx(bczip_ctx *ctx);
+
+BCZIP_API void bczip_compress_file(bczip_ctx *ctx, FILE *input, FILE *output);
+BCZIP_API void bczip_compress_stream(bczip_ctx *ctx, bczip_read_function read, bczip_write_function write,
+                                     void *user_data);
+BCZIP_API uint8_t *bczip_compress_buffer(bczip_ctx *ctx, const uint8_t *input, size_t input_size,
+                                         size_t *output_size);
+
+BCZIP_API void bczip_get_compress_stats(const bczip_ctx *ctx, bczip_compress_stats *stats);
+BCZIP_API void bczip_get_decompress_stats(const bczip_ctx *ctx, bczip_decompress_stats *stats);
+// the name of a check, e.g. "back-reference", or NULL past BCZIP_CHECKS_COUNT
+BCZIP_API const char *bczip_check_name(uint32_t check);
+// the name of a kind of token, e.g. "skip", or NULL past BCZIP_TOKENS_COUNT
+BCZIP_API const char *bczip_token_name(uint32_t token);
+
+// these return false (or NULL) when the input isn't in the bczip format
+BCZIP_API bool bczip_decompress_file(bczip_ctx *ctx, FILE *input, FILE *output);
+BCZIP_API bool bczip_decompress_stream(bczip_ctx *ctx, bczip_read_function read, bczip_write_function write,
+                                       void *user_data);
+BCZIP_API uint8_t *bczip_decompress_buffer(bczip_ctx *ctx, const uint8_t *input, size_t input_size,
+                                           size_t *output_size);
+
+// writes 'length' bytes of the decompressed data from 'start' on, decoding only the blocks
+// that hold them; 'input' must be seekable. False when a block holding them is corrupted
+BCZIP_API bool bczip_decompress_range(bczip_ctx *ctx, FILE *input, FILE *output, uint64_t start, uint64_t length);
+
+// the samples follow each other in 'samples'; returns the dictionary file, to be freed
+BCZIP_API uint8_t *bczip_train_dictionary(const uint8_t *samples, const size_t *sample_sizes,
+                                          uint32_t samples_count, size_t *dictionary_size);
+// NULL when 'data' isn't a dictionary file; it's used in place, so it must outlive the dictionary
+BCZIP_API bczip_dictionary *bczip_load_dictionary(const uint8_t *data, size_t size);
+BCZIP_API void bczip_delete_dictionary(bczip_dictionary *dictionary);
+BCZIP_API uint32_t bczip_dictionary_id(const bczip_dictionary *dictionary);
+// (de)compresses with the dictionary from then on, NULL for none; it must outlive its use
+BCZIP_API void bczip_set_dictionary(bczip_ctx *ctx, const bczip_dictionary *dictionary);
+// the id of the dictionary 'input' was compressed with, 0 for none; 'input' must be seekable
+BCZIP_API uint32_t bczip_get_dictionary_id(FILE *input);
+
+#endif
@@ -1,7 +1,30 @@
+#include "bczip.h"
 #include "types.h"
+#include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+
+extern void create_suffix_array(const u8 *text, u32 length, u32 *suffix_array);
+extern void create_lcp_array(const u8 *text, u32 length, const u32 *suffix_array, u32 *lcp_array);
+
+typedef struct bczip_dictionary_t bczip_dictionary;
+extern u32 dictionary_id(const bczip_dictionary *dictionary);
+extern u16 dictionary_items_count(const bczip_dictionary *dictionary);
+extern const u8 *dictionary_item(const bczip_dictionary *dictionary, u16 i, u16 *length);
+
+extern u32 run_length_step(const u8 *data, u32 length, u8 step);
+extern u32 run_length_rotate_left(const u8 *data, u32 length);
+extern u32 run_length_rotate_right(const u8 *data, u32 length);
+
+extern u32 huffman_encode(const u8 *data, u32 size, u8 *output, u32 capacity);
+
+typedef struct thread_pool_t thread_pool;
+extern thread_pool *create_thread_pool(u32 threads_count);
+extern void thread_pool_submit(thread_pool *pool, void (*function)(void *), void *argument);
+extern void thread_pool_wait(thread_pool *pool);
+extern void delete_thread_pool(thread_pool *pool);
 
 enum function_number {
   FN_SKIP,
@@ -22,67 +45,314 @@ enum function_number {
   FN_JUMPING_SEGMENT,
 };
 
+// what the bytes of the tokens are, each kind written in a section of its own
+enum token_section {
+  TS_OPCODES,
+  TS_PARAMETERS,
+  TS_LITERALS,
+  TOKEN_SECTIONS_COUNT,
+};
+
+typedef struct byte_buffer_t {
+  u8 *data;
+  u32 size;
+  u32 capacity;
+} byte_buffer;
+
 typedef struct compress_dictionary_item_t {
   u8 *data;
   u16 length;
   u32 usage_count;
+  u32 repeat_count; // occurrences found by create_compress_dictionary
   u16 index;
 } compress_dictionary_item;
 
+// dictionary items hashed by their first CD_ITEM_LENGTH_LIMIT bytes, every chain is ordered
+// from the longest item to the shortest one, so the first item that matches is the best one
+typedef struct compress_dictionary_index_item_t {
+  const u8 *data;
+  u64 key;
+  u16 length;
+  u16 position;
+  u16 next;
+} compress_dictionary_index_item;
+
+typedef struct compress_dictionary_part_t {
+  const u8 *data;
+  u32 length;
+  u32 repeat_count;
+} compress_dictionary_part;
+
+typedef struct back_reference_match_t {
+  u32 length;
+  u32 distance;
+} back_reference_match;
+
+// a token is kept whole in its option, the longest is a back-reference:
+// 16[index and fn] varint[length] varint[distance]
+#define CO_DATA_SIZE 12
+
 typedef struct compress_option_t {
   enum function_number fn;
   u32 offset;
-  u8 *data;
   u32 length;
   u32 coverage;
+  u8 data[CO_DATA_SIZE];
 } compress_option;
 
+// what a compression level spends its time on: 'checks' has the bit of every CHECK_FUNCTIONS
+// index it tries, 'prune_checks' lets the optimal parse drop those not paying off, a block is
+// compressed with the 'alternative' as well, when there's one, and the smaller output is kept;
+// 'entropy_parse' parses twice, the second time with the bytes priced by their entropy in the
+// tokens of the first parse, for the entropy coded output
+typedef struct compress_level_t {
+  bool dictionary;
+  bool optimal_parse;
+  bool prune_checks;
+  u32 back_reference_chain_depth;
+  u32 checks;
+  const struct compress_level_t *alternative;
+  bool entropy_parse;
+} compress_level;
+
+// the cheapest way found to reach an offset: from an earlier offset, either by the option of
+// CHECK_FUNCTIONS[check] or, when check is zero, by skipping one more byte
+typedef struct parse_node_t {
+  double price;
+  u32 from;
+  u32 skip_length;
+  u8 check;
+} parse_node;
+
+// everything a block is compressed with, so that blocks can be compressed in parallel
+typedef struct compress_state_t {
+  u8 window_log;
+  const compress_level *level;
+
+  // the items of a shared dictionary belong to the compressor: they're neither written nor
+  // paid for, and their usage isn't counted, since blocks use them in parallel
+  compress_dictionary_item *compress_dictionary;
+  u16 compress_dictionary_size;
+  bool shared_dictionary;
+  u32 dictionary_id;
+
+  // when set, the uses of the items are counted here, by index, and the items are only read
+  u32 *usage_counts;
+
+  compress_dictionary_index_item *compress_dictionary_index;
+  u16 *compress_dictionary_index_heads;
+  u8 compress_dictionary_index_bits;
+
+  u32 *back_reference_heads;
+  u32 *back_reference_chains;
+  back_reference_match *back_reference_matches;
+  u8 back_reference_heads_bits;
+
+  // kept from one compression to the next, they're only ever grown
+  compress_option *options;
+  u32 options_capacity;
+  compress_option *pass_options;
+  u32 pass_options_capacity;
+  parse_node *parse_nodes;
+  u32 parse_nodes_capacity;
+
+  // what a byte is expected to take in the output, in bytes, by its section, one without an
+  // entropy parse
+  double byte_costs[TOKEN_SECTIONS_COUNT][256];
+  double mean_byte_costs[TOKEN_SECTIONS_COUNT];
+
+  bczip_compress_stats stats;
+} compress_state;
+
+// a block keeps its buffers from one batch to the next, they're only ever grown; a block
+// compressed alone has the thread pool for the items of its dictionary
+typedef struct compress_block_t {
+  const bczip_compress_settings *settings;
+  const compress_state *shared_dictionary; // the compressor's, without items when it has none
+  thread_pool *pool;
+  compress_state state;
+  byte_buffer input;
+  byte_buffer tokens;
+  byte_buffer alternative_tokens; // those of the other parse of an entropy parse
+  byte_buffer output;
+  byte_buffer alternative_output;
+  byte_buffer entropy_coded;
+  byte_buffer sections[TOKEN_SECTIONS_COUNT];
+  byte_buffer split_output;
+} compress_block;
+
+// Dictionary items are compressed against the dictionary as it was before any of them was,
+// so that they don't depend on each other: every task compresses the items i with
+// i % tasks_count == first, with a state of its own that counts the uses it finds apart from
+// the items, and the counts of all tasks are added to the items once they're all done.
+typedef struct dictionary_items_task_t {
+  compress_state state;
+  u16 first;
+  u16 tasks_count;
+  u16 items_count;
+  u16 written_items_count;
+  byte_buffer *outputs;
+} dictionary_items_task;
+
+// a compressor keeps the blocks of a batch from one call to the next, the thread pool
+// belongs to whoever created the compressor
+typedef struct compressor_t {
+  bczip_compress_settings settings;
+  thread_pool *pool;
+  compress_block *blocks;
+  u32 blocks_capacity;
+  compress_state shared_dictionary; // only its dictionary and index are used
+  bczip_compress_stats stats;
+} compressor;
+
 // ================================================================================ external functions
 
-void compress(FILE *input, FILE *output);
+compressor *create_compressor(const bczip_compress_settings *settings, thread_pool *pool);
+void compress(compressor *compressor, FILE *input, FILE *output);
+void delete_compressor(compressor *compressor);
+void get_compress_stats(const compressor *compressor, bczip_compress_stats *stats);
+void set_compressor_dictionary(compressor *compressor, const bczip_dictionary *dictionary);
+const char *check_name(u32 check);
+const char *token_name(u32 token);
 
 // ================================================================================ internal functions
 
-static i32 dictionary_items_data_compare(const void *a, const void *b);
+static void buffer_reserve(byte_buffer *buffer, u32 size);
+static void buffer_put(byte_buffer *buffer, u8 ch);
+static void buffer_write(byte_buffer *buffer, const void *data, u32 size);
+static void buffer_read_stream(byte_buffer *buffer, FILE *stream, u32 size_limit);
+static i16 buffer_get(const byte_buffer *buffer, u32 offset);
+
 static i32 dictionary_items_usage_count_compare(const void *a, const void *b);
 static i32 dictionary_items_length_compare(const void *a, const void *b);
 
-static i32 options_compare(const void *a, const void *b);
-static i32 parts_compare(const void *a, const void *b);
-
-static compress_option check_repeat_byte(FILE *input, u32 coverage_limit);
-static compress_option check_repeat_byte_long(FILE *input, u32 coverage_limit);
-static compress_option check_repeat_string(FILE *input, u32 coverage_limit);
-static compress_option check_repeat_string_long(FILE *input, u32 coverage_limit);
-static compress_option check_mirror_string(FILE *input, u32 coverage_limit);
-static compress_option check_dictionary(FILE *input, u32 coverage_limit);
-static compress_option check_one_particular_byte(FILE *input, u32 coverage_limit);
-static compress_option check_arithmetic_progression(FILE *input, u32 coverage_limit);
-static compress_option check_geometric_progression(FILE *input, u32 coverage_limit);
-static compress_option check_fibonacci_progression(FILE *input, u32 coverage_limit);
-static compress_option check_shift_left(FILE *input, u32 coverage_limit);
-static compress_option check_shift_right(FILE *input, u32 coverage_limit);
-static compress_option check_offset_segment(FILE *input, u32 coverage_limit);
-static compress_option check_jumping_segment(FILE *input, u32 coverage_limit);
-
-static void perform_compression(FILE *input, FILE *output);
-
-static void create_compress_dictionary(FILE *input);
-static void optimize_compress_dictionary(u16 *new_dictionary_indexes);
-static void delete_compress_dictionary(void);
-
-static void write_compress_dictionary(FILE *output);
-static void write_compress_data(FILE *input, FILE *output, const u16 *new_dictionary_indexes);
+static void options_reserve(compress_option **options, u32 *options_capacity, u32 size);
+static void merge_options(compress_state *state, u32 options_size, u32 pass_options_size);
+
+static compress_option check_repeat_byte(const compress_state *state, const byte_buffer *input, u32 offset, u32 coverage_limit);
+static compress_option check_repeat_byte_long(const compress_state *state, const byte_buffer *input, u32 offset, u32 coverage_limit);
+static compress_option check_repeat_string(const compress_state *state, const byte_buffer *input, u32 offset, u32 coverage_limit);
+static compress_option check_repeat_string_long(const compress_state *state, const byte_buffer *input, u32 offset, u32 coverage_limit);
+static compress_option check_mirror_string(const compress_state *state, const byte_buffer *input, u32 offset, u32 coverage_limit);
+static compress_option check_dictionary(const compress_state *state, const byte_buffer *input, u32 offset, u32 coverage_limit);
+static compress_option check_one_particular_byte(const compress_state *state, const byte_buffer *input, u32 offset, u32 coverage_limit);
+static compress_option check_arithmetic_progression(const compress_state *state, const byte_buffer *input, u32 offset, u32 coverage_limit);
+static compress_option check_geometric_progression(const compress_state *state, const byte_buffer *input, u32 offset, u32 coverage_limit);
+static compress_option check_fibonacci_progression(const compress_state *state, const byte_buffer *input, u32 offset, u32 coverage_limit);
+static compress_option check_shift_left(const compress_state *state, const byte_buffer *input, u32 offset, u32 coverage_limit);
+static compress_option check_shift_right(const compress_state *state, const byte_buffer *input, u32 offset, u32 coverage_limit);
+static compress_option check_back_reference(const compress_state *state, const byte_buffer *input, u32 offset, u32 coverage_limit);
+
+static u32 match_length(const u8 *a, const u8 *b, u32 length_limit);
+static u8 write_varint(u8 *data, u32 value);
+static u32 back_reference_hash(const compress_state *state, const u8 *data);
+static void create_back_reference_chains(compress_state *state, const byte_buffer *input);
+static void delete_back_reference_chains(compress_state *state);
+
+static u16 option_dictionary_index(const compress_option *co);
+static double option_cost(const compress_state *state, const compress_option *co);
+static void count_dictionary_use(compress_state *state, const compress_option *co);
+static double parse_cost(const compress_state *state, const compress_option *co);
+static u32 skip_cost(u32 skip_length);
+static double price_bytes(compress_state *state, const byte_buffer *sections);
+static double binary_log(double x);
+static u32 parse_greedy(compress_state *state, const byte_buffer *input);
+static void count_segment(compress_state *state, u32 checks);
+static u32 parse_optimal(compress_state *state, const byte_buffer *input);
+static u8 option_token(const compress_option *co);
+static void perform_compression(compress_state *state, const byte_buffer *input, byte_buffer *output, bczip_token_stats *tokens);
+static void parse_block(compress_block *block, bczip_token_stats *tokens);
+
+static void create_compress_dictionary(compress_state *state, const byte_buffer *input);
+static void compress_dictionary_items_task(void *task);
+static void optimize_compress_dictionary(compress_state *state, u16 *new_dictionary_indexes, thread_pool *pool,
+                                         u32 threads_count);
+static void delete_compress_dictionary(compress_state *state);
+
+static u64 dictionary_key(const u8 *data);
+static u32 dictionary_key_slot(const compress_state *state, u64 key);
+static void create_compress_dictionary_index(compress_state *state);
+static void delete_compress_dictionary_index(compress_state *state);
+
+static void write_compress_dictionary(const compress_state *state, byte_buffer *output);
+static void write_compress_data(const compress_state *state, const byte_buffer *input, byte_buffer *output,
+                         const u16 *new_dictionary_indexes, bczip_token_stats *tokens);
+
+static void entropy_code_stream(compress_state *state, byte_buffer *output, byte_buffer *coded);
+static void split_tokens(const u8 *data, u32 size, byte_buffer *sections);
+static void write_section(byte_buffer *output, const u8 *data, u32 size, byte_buffer *coded);
+static void split_stream(compress_block *block, const byte_buffer *output, u32 tokens_start);
+static void code_stream(compress_block *block, byte_buffer *output, u32 tokens_start);
+static void compress_block_level(compress_block *block, const compress_level *level, byte_buffer *output);
+static void compress_block_task(void *block);
+static double seconds(void);
+static void add_compress_stats(bczip_compress_stats *stats, const bczip_compress_stats *other, bool output);
+static void write_u32(FILE *output, u32 value);
 
 // ================================================================================ internal variables
 
-static compress_option next_comparison_option;
-
 static const u32 CD_ITEM_LENGTH_LIMIT = 8;
-static compress_dictionary_item *compress_dictionary = NULL;
-static u16 compress_dictionary_size = 0;
+static const u16 CD_INDEX_END = 0xFFFF;
+
+// a dictionary reference to this index is followed by a back-reference:
+// varint[length - BR_LENGTH_LIMIT] varint[distance - 1]
+static const u16 BACK_REFERENCE_INDEX = 0xFFF;
+static const u16 BACK_REFERENCE_INDEX_AND_FN = (0xFFF << 4) + FN_DICTIONARY;
+static const u32 BR_LENGTH_LIMIT = 6;
+static const u32 BR_CHAIN_END = 0xFFFFFFFF;
+static const u32 BR_LENGTH_MAX = 0xFFFF;
+static const u32 BR_MATCH_UNKNOWN = 0xFFFFFFFF;
+
+// checks of the fast levels: runs of a byte, dictionary items and back-references
+static const u32 CL_FAST_CHECKS = (1u << FN_REPEAT_BYTE) | (1u << FN_REPEAT_BYTE_LONG) | (1u << FN_DICTIONARY) | (1u << 16);
+// checks of the other levels: all but the segments, which are only decoded, since their nibbles
+// cost more than the literals they replace once those are entropy coded
+static const u32 CL_CHECKS = 0x1FFFC & ~((1u << FN_OFFSET_SEGMENT) | (1u << FN_JUMPING_SEGMENT));
+
+// the optimal parse drops the checks that don't pay off in a probe segment until the next probe
+static const u32 CP_SEGMENT_LENGTH = 0x4000;
+static const u32 CP_PROBE_INTERVAL = 16;
+static const u32 CP_WIN_SHARE = 256;
+// runs of a byte and back-references are never dropped, they're what repetitive input is made of
+static const u32 CP_KEPT_CHECKS = (1u << FN_REPEAT_BYTE) | (1u << FN_REPEAT_BYTE_LONG) | (1u << 16);
+
+static const u32 PO_LONG_COVERAGE = 256;
+static const u32 PO_LONG_RATIO = 16;
+
+// the longest code the entropy coder gives a byte
+static const double BP_BITS_MAX = 11;
+
+static const u32 INDEX_FOOTER_MAGIC = 0x58494342; // "BCIX"
+
+// set in the window log of a stream whose dictionary and tokens are entropy coded, whole or
+// in sections, which is only done when it saves at least 1/EC_SAVING_RATIO of what's coded,
+// so that it's worth decoding
+static const u8 ENTROPY_CODED = 0x80;
+static const u8 SPLIT_SECTIONS = 0x40;
+static const u32 EC_SAVING_RATIO = 32;
+
+// indexed by function number, then the back-reference, like CHECK_FUNCTIONS
+static const char *const TOKEN_NAMES[BCZIP_TOKENS_COUNT] = {
+  "skip",
+  "skip-long",
+  "repeat-byte",
+  "repeat-byte-long",
+  "repeat-string",
+  "repeat-string-long",
+  "mirror-string",
+  "dictionary",
+  "one-particular-byte",
+  "arithmetic-progression",
+  "geometric-progression",
+  "fibonacci-progression",
+  "shift-left",
+  "shift-right",
+  "offset-segment",
+  "jumping-segment",
+  "back-reference",
+};
 
-static compress_option (*const CHECK_FUNCTIONS[])(FILE *, u32) = {
+static compress_option (*const CHECK_FUNCTIONS[])(const compress_state *, const byte_buffer *, u32, u32) = {
   NULL,
   NULL,
   check_repeat_byte,
@@ -97,17 +367,73 @@ static compress_option (*const CHECK_FUNCTIONS[])(FILE *, u32) = {
   check_fibonacci_progression,
   check_shift_left,
   check_shift_right,
-  check_offset_segment,
-  check_jumping_segment,
+  NULL, // FN_OFFSET_SEGMENT
+  NULL, // FN_JUMPING_SEGMENT
+  check_back_reference, // FN_DICTIONARY with BACK_REFERENCE_INDEX
+};
+
+// the greedy passes over a dictionary, which the smallest level tries as well, since they win
+// on inputs made of a small set of words or of sparse records
+static const compress_level CL_GREEDY = {true, false, false, 64, CL_CHECKS, NULL};
+
+// indexed by level, from the fastest to the smallest output; the dictionary isn't built by
+// default, since the optimal parse finds back-references that are cheaper than its items
+static const compress_level COMPRESS_LEVELS[] = {
+  {0},
+  {false, true, true, 4, CL_FAST_CHECKS, NULL},
+  {false, true, true, 16, CL_FAST_CHECKS, NULL},
+  {false, true, true, 16, CL_CHECKS, NULL},
+  {false, true, true, 32, CL_CHECKS, NULL},
+  {false, true, true, 64, CL_CHECKS, NULL},
+  {false, true, true, 128, CL_CHECKS, NULL},
+  {false, true, true, 256, CL_CHECKS, NULL, true},
+  {false, true, true, 1024, CL_CHECKS, NULL, true},
+  {false, true, true, 4096, CL_CHECKS, &CL_GREEDY, true},
 };
 
 // ================================================================================ definitions
 
-i32 dictionary_items_data_compare(const void *a, const void *b)
+void buffer_reserve(byte_buffer *buffer, u32 size)
+{
+  if (buffer->size + size <= buffer->capacity) { return; }
+
+  if (!buffer->capacity) { buffer->capacity = 256; }
+  while (buffer->size + size > buffer->capacity) {
+    buffer->capacity *= 2;
+  }
+
+  buffer->data = realloc(buffer->data, buffer->capacity * sizeof(u8));
+}
+
+void buffer_put(byte_buffer *buffer, u8 ch)
+{
+  buffer_reserve(buffer, 1);
+  buffer->data[buffer->size++] = ch;
+}
+
+void buffer_write(byte_buffer *buffer, const void *data, u32 size)
+{
+  buffer_reserve(buffer, size);
+  memcpy(buffer->data + buffer->size, data, size);
+  buffer->size += size;
+}
+
+void buffer_read_stream(byte_buffer *buffer, FILE *stream, u32 size_limit)
 {
-  const compress_dictionary_item av = *(compress_dictionary_item *)a;
-  const compress_dictionary_item bv = *(compress_dictionary_item *)b;
-  return memcmp(av.data, bv.data, (av.length < bv.length ? av.length : bv.length) * sizeof(u8));
+  while (buffer->size < size_limit) {
+    buffer_reserve(buffer, 0x10000);
+
+    const u32 capacity = buffer->capacity < size_limit ? buffer->capacity : size_limit;
+    const u32 length = fread(buffer->data + buffer->size, sizeof(u8), capacity - buffer->size, stream);
+    if (!length) { break; }
+
+    buffer->size += length;
+  }
+}
+
+i16 buffer_get(const byte_buffer *buffer, u32 offset)
+{
+  return offset < buffer->size ? buffer->data[offset] : EOF;
 }
 
 i32 dictionary_items_usage_count_compare(const void *a, const void *b)
@@ -120,281 +446,232 @@ i32 dictionary_items_length_compare(const void *a, const void *b)
   return ((compress_dictionary_item *)a)->length - ((compress_dictionary_item *)b)->length;
 }
 
-i32 options_compare(const void *a, const void *b)
-{
-  const compress_option av = *(compress_option *)a;
-  const compress_option bv = *(compress_option *)b;
-  if (bv.offset > av.offset) { next_comparison_option = bv; }
-  return av.offset - bv.offset;
-}
-
-i32 parts_compare(const void *a, const void *b)
+void options_reserve(compress_option **options, u32 *options_capacity, u32 size)
 {
-  const i16 *const av = *(i16 **)a;
-  const i16 *const bv = *(i16 **)b;
+  if (size <= *options_capacity) { return; }
 
-  u32 min_length = 0;
-  while (av[min_length] != EOF && bv[min_length] != EOF) {
-    min_length++;
+  if (!*options_capacity) { *options_capacity = 256; }
+  while (size > *options_capacity) {
+    *options_capacity *= 2;
   }
 
-  return memcmp(av, bv, min_length * sizeof(i16));
+  *options = realloc(*options, *options_capacity * sizeof(compress_option));
 }
 
-compress_option check_repeat_byte(FILE *input, u32 coverage_limit)
+// both lists are ordered by offset and no two options share one, so the options of a pass are
+// merged in from the back, each one moved only once
+void merge_options(compress_state *state, u32 options_size, u32 pass_options_size)
 {
-  if (!ftell(input)) { return (compress_option){0}; }
-  coverage_limit = coverage_limit > 16 ? 16 : coverage_limit;
+  options_reserve(&state->options, &state->options_capacity, options_size + pass_options_size + 1);
 
-  fseek(input, -1, SEEK_CUR);
-  const u8 ch = getc(input);
+  compress_option *const options = state->options;
+  const compress_option *const pass_options = state->pass_options;
 
-  u32 i = 0;
-  while (getc(input) == ch && i < coverage_limit) {
-    i++;
+  u32 i = options_size;
+  u32 j = pass_options_size;
+  u32 k = options_size + pass_options_size;
+  while (j) {
+    options[--k] = i && options[i - 1].offset > pass_options[j - 1].offset ? options[--i] : pass_options[--j];
   }
+}
+
+compress_option check_repeat_byte(const compress_state *state, const byte_buffer *input, u32 offset, u32 coverage_limit)
+{
+  if (!offset) { return (compress_option){0}; }
+  coverage_limit = coverage_limit > 16 ? 16 : coverage_limit;
 
+  const u32 i = run_length_step(input->data + offset, coverage_limit, 0);
   if (!i) { return (compress_option){0}; }
 
-  const compress_option co = {FN_REPEAT_BYTE, 0, malloc(1 * sizeof(u8)), 1, i};
+  compress_option co = {FN_REPEAT_BYTE, 0, 1, i};
   *co.data = ((i - 1) << 4) + FN_REPEAT_BYTE;
   return co;
 }
 
-compress_option check_repeat_byte_long(FILE *input, u32 coverage_limit)
+compress_option check_repeat_byte_long(const compress_state *state, const byte_buffer *input, u32 offset, u32 coverage_limit)
 {
-  if (!ftell(input)) { return (compress_option){0}; }
+  if (!offset) { return (compress_option){0}; }
   coverage_limit = coverage_limit > 4096 ? 4096 : coverage_limit;
 
-  fseek(input, -1, SEEK_CUR);
-  const u8 ch = getc(input);
-
-  u32 i = 0;
-  while (getc(input) == ch && i < coverage_limit) {
-    i++;
-  }
-
+  const u32 i = run_length_step(input->data + offset, coverage_limit, 0);
   if (!i) { return (compress_option){0}; }
 
-  const compress_option co = {FN_REPEAT_BYTE_LONG, 0, malloc(2 * sizeof(u8)), 2, i};
+  compress_option co = {FN_REPEAT_BYTE_LONG, 0, 2, i};
   co.data[0] = ((i - 1) << 4) + FN_REPEAT_BYTE_LONG;
   co.data[1] = (i - 1) >> 4;
   return co;
 }
 
-compress_option check_repeat_string(FILE *input, u32 coverage_limit)
+compress_option check_repeat_string(const compress_state *state, const byte_buffer *input, u32 offset, u32 coverage_limit)
 {
   coverage_limit = coverage_limit > 17 ? 17 : coverage_limit;
-  coverage_limit = coverage_limit > ftell(input) ? ftell(input) : coverage_limit;
+  coverage_limit = coverage_limit > offset ? offset : coverage_limit;
   if (coverage_limit < 2) { return (compress_option){0}; }
 
-  u8 *const str = alloca(coverage_limit * sizeof(u8));
-  fread(str, sizeof(u8), coverage_limit, input);
-
-  fseek(input, -(i8)coverage_limit * 2, SEEK_CUR);
-  while (coverage_limit) {
-    i8 i = 0;
-    while (getc(input) == str[i] && i < coverage_limit) {
-      i++;
-    }
-
-    if (i == coverage_limit) { break; }
-
-    fseek(input, -i, SEEK_CUR);
+  const u8 *const str = input->data + offset;
+  while (coverage_limit && memcmp(str - coverage_limit, str, coverage_limit * sizeof(u8))) {
     coverage_limit--;
   }
 
   if (coverage_limit < 2) { return (compress_option){0}; }
 
-  const compress_option co = {FN_REPEAT_STRING, 0, malloc(1 * sizeof(u8)), 1, coverage_limit};
+  compress_option co = {FN_REPEAT_STRING, 0, 1, coverage_limit};
   *co.data = ((coverage_limit - 2) << 4) + FN_REPEAT_STRING;
   return co;
 }
 
-compress_option check_repeat_string_long(FILE *input, u32 coverage_limit)
+compress_option check_repeat_string_long(const compress_state *state, const byte_buffer *input, u32 offset, u32 coverage_limit)
 {
-  if (ftell(input) < 2 || coverage_limit < 4) { return (compress_option){0}; }
-  u8 length = ftell(input) > 17 ? 17 : ftell(input);
+  if (offset < 2 || coverage_limit < 4) { return (compress_option){0}; }
+  u8 length = offset > 17 ? 17 : offset;
 
-  u8 *str = alloca(length * sizeof(u8));
-  fseek(input, -(i8)length, SEEK_CUR);
-  fread(str, sizeof(u8), length, input);
+  const u8 *const str = input->data + offset - length;
 
   bool found = false;
   for (u8 i = 0; i < length - 1; ++i) {
-    const i32 offset = ftell(input);
-
-    u8 j = i;
-    while (j < length && str[j] == getc(input)) {
-      j++;
-    }
+    if (offset + length - i > input->size) { continue; }
 
-    if (j == length) {
+    if (!memcmp(input->data + offset, str + i, (length - i) * sizeof(u8))) {
       found = true;
-      str += i;
       length -= i;
       break;
     }
-
-    fseek(input, offset, SEEK_SET);
   }
 
-  if (!found) { return (compress_option){0}; }
+  if (!found || length * 2 > coverage_limit) { return (compress_option){0}; }
 
-  u32 count = 0;
-  i16 ch;
-  while ((ch = getc(input)) != EOF && ch == str[count % length]) {
-    count++;
-  }
+  // counting stops once it can't change the result (capped at 256 repetitions) or the
+  // repetitions would cover more than allowed
+  // the repetitions are compared against the string before them, a word at a time
+  u32 count_limit = length * 257 < coverage_limit - length ? length * 257 : coverage_limit - length;
+  const u32 count_offset = offset + length;
+  if (count_limit > input->size - count_offset) { count_limit = input->size - count_offset; }
 
-  count /= length;
+  u32 count = match_length(input->data + count_offset, input->data + offset, count_limit) / length;
   if (count > 256) { count = 256; }
   if (!count) { return (compress_option){0}; }
 
-  const compress_option co = {FN_REPEAT_STRING_LONG, 0, malloc(2 * sizeof(u8)), 2, length * (count + 1)};
+  compress_option co = {FN_REPEAT_STRING_LONG, 0, 2, length * (count + 1)};
   co.data[0] = ((length - 2) << 4) + FN_REPEAT_STRING_LONG;
   co.data[1] = count - 1;
   return co;
 }
 
-compress_option check_mirror_string(FILE *input, u32 coverage_limit)
+compress_option check_mirror_string(const compress_state *state, const byte_buffer *input, u32 offset, u32 coverage_limit)
 {
   coverage_limit = coverage_limit > 17 ? 17 : coverage_limit;
-  coverage_limit = coverage_limit > ftell(input) ? ftell(input) : coverage_limit;
+  coverage_limit = coverage_limit > offset ? offset : coverage_limit;
   if (coverage_limit < 2) { return (compress_option){0}; }
 
-  fseek(input, -(i8)coverage_limit, SEEK_CUR);
-  u8 *const str = alloca(coverage_limit * sizeof(u8));
-  fread(str, sizeof(u8), coverage_limit, input);
+  const u8 *const str = input->data + offset;
 
   u8 i = 0;
-  while (i < coverage_limit && getc(input) == str[coverage_limit - i - 1]) {
+  while (i < coverage_limit && str[i] == str[-i - 1]) {
     i++;
   }
 
   if (i < 2) { return (compress_option){0}; }
 
-  const compress_option co = {FN_MIRROR_STRING, 0, malloc(1 * sizeof(u8)), 1, i};
+  compress_option co = {FN_MIRROR_STRING, 0, 1, i};
   *co.data = ((i - 2) << 4) + FN_MIRROR_STRING;
   return co;
 }
 
-compress_option check_dictionary(FILE *input, u32 coverage_limit)
+compress_option check_dictionary(const compress_state *state, const byte_buffer *input, u32 offset, u32 coverage_limit)
 {
-  if (coverage_limit < CD_ITEM_LENGTH_LIMIT) { return (compress_option){0}; }
-
-  const compress_dictionary_item *found_item = NULL;
-  compress_dictionary_item key_item = {malloc((CD_ITEM_LENGTH_LIMIT + 1) * sizeof(u8)), CD_ITEM_LENGTH_LIMIT, 0, 0};
-  fread(key_item.data, sizeof(u8), CD_ITEM_LENGTH_LIMIT, input);
-
-  for (;;) {
-    const compress_dictionary_item *const item =
-      bsearch(&key_item, compress_dictionary, compress_dictionary_size,
-              sizeof(compress_dictionary_item), dictionary_items_data_compare);
-
-    if (!item) { break; }
+  if (coverage_limit < CD_ITEM_LENGTH_LIMIT || !state->compress_dictionary_index_heads) { return (compress_option){0}; }
 
-    const u16 item_length = item->length;
-    if (item_length < key_item.length || item_length > coverage_limit) { break; }
+  const u8 *const str = input->data + offset;
+  const u64 key = dictionary_key(str);
 
-    if (item_length > key_item.length) {
-      key_item.data = realloc(key_item.data, (item_length + 1) * sizeof(u8));
-      fread(key_item.data + key_item.length, sizeof(u8), item_length - key_item.length, input);
-      key_item.length = item_length;
+  // items past state->compress_dictionary_size aren't usable yet (see optimize_compress_dictionary)
+  const compress_dictionary_index_item *found_item = NULL;
+  for (u16 i = state->compress_dictionary_index_heads[dictionary_key_slot(state, key)];
+       i != CD_INDEX_END; i = state->compress_dictionary_index[i].next) {
+    const compress_dictionary_index_item *const item = state->compress_dictionary_index + i;
+    if (item->key != key || item->length > coverage_limit || item->position >= state->compress_dictionary_size) { continue; }
 
-      if (memcmp(item->data, key_item.data, item_length * sizeof(u8))) { break; }
+    if (!memcmp(item->data + CD_ITEM_LENGTH_LIMIT, str + CD_ITEM_LENGTH_LIMIT,
+                (item->length - CD_ITEM_LENGTH_LIMIT) * sizeof(u8))) {
+      found_item = item;
+      break;
     }
-
-    if (found_item && found_item->usage_count > item->usage_count) { break; }
-    found_item = item;
-
-    if (key_item.length + 1 > coverage_limit) { break; }
-    key_item.data[key_item.length++] = getc(input);
   }
 
-  free(key_item.data);
-
   if (!found_item) { return (compress_option){0}; }
-  const u16 index = found_item - compress_dictionary;
+  const u16 index = found_item->position;
 
-  const compress_option co = {FN_DICTIONARY, 0, malloc(2 * sizeof(u8)), 2, found_item->length};
+  compress_option co = {FN_DICTIONARY, 0, 2, found_item->length};
   co.data[0] = (index << 4) + FN_DICTIONARY;
   co.data[1] = index >> 4;
   return co;
 }
 
-compress_option check_one_particular_byte(FILE *input, u32 coverage_limit)
+compress_option check_one_particular_byte(const compress_state *state, const byte_buffer *input, u32 offset, u32 coverage_limit)
 {
-  const u8 ch = getc(input);
+  const u8 ch = buffer_get(input, offset);
   if (ch % 0x11 || !coverage_limit) { return (compress_option){0}; }
 
-  const compress_option co = {FN_ONE_PARTICULAR_BYTE, 0, malloc(1 * sizeof(u8)), 1, 1};
+  compress_option co = {FN_ONE_PARTICULAR_BYTE, 0, 1, 1};
   *co.data = ((ch / 0x11) << 4) + FN_ONE_PARTICULAR_BYTE;
   return co;
 }
 
-compress_option check_arithmetic_progression(FILE *input, u32 coverage_limit)
+compress_option check_arithmetic_progression(const compress_state *state, const byte_buffer *input, u32 offset, u32 coverage_limit)
 {
-  if (!ftell(input)) { return (compress_option){0}; }
+  if (!offset) { return (compress_option){0}; }
   coverage_limit = coverage_limit > 16 ? 16 : coverage_limit;
 
-  fseek(input, -1, SEEK_CUR);
-  u8 value = getc(input);
-  const i16 factor = getc(input) - value;
-  ungetc(factor + value, input);
-
-  u8 i = 0;
-  while (getc(input) == (value += factor) && i < coverage_limit) {
-    i++;
-  }
+  const u8 *const str = input->data + offset;
+  const i16 factor = buffer_get(input, offset) - str[-1];
 
+  const u8 i = run_length_step(str, coverage_limit, factor);
   if (!i) { return (compress_option){0}; }
 
-  const compress_option co = {FN_ARITHMETIC_PROGRESSION, 0, malloc(2 * sizeof(u8)), 2, i};
+  compress_option co = {FN_ARITHMETIC_PROGRESSION, 0, 2, i};
   co.data[0] = ((i - 1) << 4) + FN_ARITHMETIC_PROGRESSION;
   co.data[1] = factor;
   return co;
 }
 
-compress_option check_geometric_progression(FILE *input, u32 coverage_limit)
+compress_option check_geometric_progression(const compress_state *state, const byte_buffer *input, u32 offset, u32 coverage_limit)
 {
-  if (!ftell(input)) { return (compress_option){0}; }
+  if (!offset) { return (compress_option){0}; }
   coverage_limit = coverage_limit > 16 ? 16 : coverage_limit;
 
-  fseek(input, -1, SEEK_CUR);
-  u8 value = getc(input);
+  const u8 *const str = input->data + offset;
+  u8 value = str[-1];
 
-  const u8 base = getc(input);
+  const u8 base = buffer_get(input, offset);
   if (!value || base % value) { return (compress_option){0}; }
 
   const i16 factor = base / value;
-  ungetc(base, input);
 
   u8 i = 0;
-  while (getc(input) == (value *= factor) && i < coverage_limit) {
+  while (i < coverage_limit && str[i] == (u8)(value *= factor)) {
     i++;
   }
 
   if (!i) { return (compress_option){0}; }
 
-  const compress_option co = {FN_GEOMETRIC_PROGRESSION, 0, malloc(2 * sizeof(u8)), 2, i};
+  compress_option co = {FN_GEOMETRIC_PROGRESSION, 0, 2, i};
   co.data[0] = ((i - 1) << 4) + FN_GEOMETRIC_PROGRESSION;
   co.data[1] = factor;
   return co;
 }
 
-compress_option check_fibonacci_progression(FILE *input, u32 coverage_limit)
+compress_option check_fibonacci_progression(const compress_state *state, const byte_buffer *input, u32 offset, u32 coverage_limit)
 {
-  if (ftell(input) < 2) { return (compress_option){0}; }
+  if (offset < 2) { return (compress_option){0}; }
   coverage_limit = coverage_limit > 16 ? 16 : coverage_limit;
 
-  fseek(input, -2, SEEK_CUR);
-  u8 first = getc(input);
-  u8 second = getc(input);
+  const u8 *const str = input->data + offset;
+  u8 first = str[-2];
+  u8 second = str[-1];
   u8 next;
 
   u32 count = 0;
-  while (getc(input) == (next = first + second) && count < coverage_limit) {
+  while (count < coverage_limit && str[count] == (next = first + second)) {
     first = second;
     second = next;
     count++;
@@ -402,228 +679,501 @@ compress_option check_fibonacci_progression(FILE *input, u32 coverage_limit)
 
   if (!count) { return (compress_option){0}; }
 
-  const compress_option co = {FN_FIBONACCI_PROGRESSION, 0, malloc(1 * sizeof(u8)), 1, count};
+  compress_option co = {FN_FIBONACCI_PROGRESSION, 0, 1, count};
   *co.data = ((count - 1) << 4) + FN_FIBONACCI_PROGRESSION;
   return co;
 }
 
-compress_option check_shift_left(FILE *input, u32 coverage_limit)
+compress_option check_shift_left(const compress_state *state, const byte_buffer *input, u32 offset, u32 coverage_limit)
 {
-  if (!ftell(input)) { return (compress_option){0}; }
+  if (!offset) { return (compress_option){0}; }
   coverage_limit = coverage_limit > 16 ? 16 : coverage_limit;
 
-  fseek(input, -1, SEEK_CUR);
-  u8 value = getc(input);
-
-  u8 count = 0;
-  while (getc(input) == (value = (value << 1) | (value >> 7)) && count < coverage_limit) {
-    count++;
-  }
-
+  const u8 count = run_length_rotate_left(input->data + offset, coverage_limit);
   if (!count) { return (compress_option){0}; }
 
-  const compress_option co = {FN_SHIFT_LEFT, 0, malloc(1 * sizeof(u8)), 1, count};
+  compress_option co = {FN_SHIFT_LEFT, 0, 1, count};
   *co.data = ((count - 1) << 4) + FN_SHIFT_LEFT;
   return co;
 }
 
-compress_option check_shift_right(FILE *input, u32 coverage_limit)
+compress_option check_shift_right(const compress_state *state, const byte_buffer *input, u32 offset, u32 coverage_limit)
 {
-  if (!ftell(input)) { return (compress_option){0}; }
+  if (!offset) { return (compress_option){0}; }
   coverage_limit = coverage_limit > 16 ? 16 : coverage_limit;
 
-  fseek(input, -1, SEEK_CUR);
-  u8 value = getc(input);
+  const u8 count = run_length_rotate_right(input->data + offset, coverage_limit);
+  if (!count) { return (compress_option){0}; }
 
-  u8 count = 0;
-  while (getc(input) == (value = (value >> 1) | (value << 7)) && count < coverage_limit) {
-    count++;
+  compress_option co = {FN_SHIFT_RIGHT, 0, 1, count};
+  *co.data = ((count - 1) << 4) + FN_SHIFT_RIGHT;
+  return co;
+}
+
+compress_option check_back_reference(const compress_state *state, const byte_buffer *input, u32 offset, u32 coverage_limit)
+{
+  if (coverage_limit < BR_LENGTH_LIMIT || !state->back_reference_chains) { return (compress_option){0}; }
+
+  // the longest match is looked for once per position, since every pass only lowers the
+  // coverage limit and a cut down longest match is still the longest one under the limit
+  back_reference_match *const match = state->back_reference_matches + offset;
+  if (match->length == BR_MATCH_UNKNOWN) {
+    const u8 *const str = input->data + offset;
+    const u32 window = 1u << state->window_log;
+    const u32 length_limit = input->size - offset < BR_LENGTH_MAX ? input->size - offset : BR_LENGTH_MAX;
+
+    *match = (back_reference_match){0, 0};
+
+    // the match of the previous position, if it was long, goes on here one byte shorter
+    if (offset && match[-1].length != BR_MATCH_UNKNOWN && match[-1].length > BR_LENGTH_LIMIT) {
+      const u32 known_length = match[-1].length - 1;
+      const u8 *const candidate = str - match[-1].distance;
+      *match = (back_reference_match){
+        known_length + match_length(candidate + known_length, str + known_length, length_limit - known_length),
+        match[-1].distance,
+      };
+    }
+
+    u32 depth = state->level->back_reference_chain_depth;
+    for (u32 position = state->back_reference_chains[offset];
+         match->length < length_limit && position != BR_CHAIN_END && offset - position <= window && depth--;
+         position = state->back_reference_chains[position]) {
+      const u8 *const candidate = input->data + position;
+      if (candidate[match->length] != str[match->length]) { continue; }
+
+      const u32 length = match_length(candidate, str, length_limit);
+      if (length > match->length) { *match = (back_reference_match){length, offset - position}; }
+    }
   }
 
-  if (!count) { return (compress_option){0}; }
+  const u32 length = match->length < coverage_limit ? match->length : coverage_limit;
+  const u32 distance = match->distance;
 
-  const compress_option co = {FN_SHIFT_RIGHT, 0, malloc(1 * sizeof(u8)), 1, count};
-  *co.data = ((count - 1) << 4) + FN_SHIFT_RIGHT;
+  if (length < BR_LENGTH_LIMIT) { return (compress_option){0}; }
+
+  compress_option co = {FN_DICTIONARY, 0, 2, length};
+  memcpy(co.data, &BACK_REFERENCE_INDEX_AND_FN, sizeof(u16));
+
+  co.length += write_varint(co.data + co.length, length - BR_LENGTH_LIMIT);
+  co.length += write_varint(co.data + co.length, distance - 1);
   return co;
 }
 
-compress_option check_offset_segment(FILE *input, u32 coverage_limit)
+u32 match_length(const u8 *a, const u8 *b, u32 length_limit)
 {
-  if (coverage_limit < 2) { return (compress_option){0}; }
-  coverage_limit = coverage_limit > 512 ? 512 : coverage_limit;
+  u32 length = 0;
+  while (length + sizeof(u64) <= length_limit) {
+    u64 av, bv;
+    memcpy(&av, a + length, sizeof(u64));
+    memcpy(&bv, b + length, sizeof(u64));
+
+    if (av != bv) { return length + __builtin_ctzll(av ^ bv) / 8; }
+    length += sizeof(u64);
+  }
 
-  const i32 pos = ftell(input);
+  while (length < length_limit && a[length] == b[length]) {
+    length++;
+  }
 
-  i16 count = 1;
-  const u8 offset = getc(input) & 0xF0;
-  while ((getc(input) & 0xF0) == offset && count < coverage_limit) {
-    count++;
+  return length;
+}
+
+u8 write_varint(u8 *data, u32 value)
+{
+  u8 length = 0;
+  while (value > 0x7F) {
+    data[length++] = (value & 0x7F) | 0x80;
+    value >>= 7;
   }
 
-  fseek(input, pos, SEEK_SET);
+  data[length++] = value;
+  return length;
+}
 
-  count /= 2;
-  if (count < 2) { return (compress_option){0}; }
+u32 back_reference_hash(const compress_state *state, const u8 *data)
+{
+  u32 value;
+  memcpy(&value, data, sizeof(u32));
+  return (value * 2654435761u) >> (32 - state->back_reference_heads_bits);
+}
 
-  const compress_option co = {FN_OFFSET_SEGMENT, 0, malloc((count + 2) * sizeof(u8)), count + 2, count * 2};
-  co.data[0] = offset + FN_OFFSET_SEGMENT;
-  co.data[1] = count - 1;
+// every position is chained to the previous one starting with the same 4 bytes, so any
+// position can walk back over its candidates no matter in what order positions are checked
+void create_back_reference_chains(compress_state *state, const byte_buffer *input)
+{
+  const u32 input_length = input->size;
+  if (input_length < BR_LENGTH_LIMIT) { return; }
 
-  for (u16 i = 2; count-- > 0; i++) {
-    co.data[i] = (getc(input) << 4) + (getc(input) & 0x0F);
+  state->back_reference_heads_bits = 8;
+  while (state->back_reference_heads_bits < 16 && (1u << state->back_reference_heads_bits) < input_length) {
+    state->back_reference_heads_bits++;
   }
 
-  return co;
+  const u32 heads_size = 1u << state->back_reference_heads_bits;
+  state->back_reference_heads = malloc(heads_size * sizeof(u32));
+  memset(state->back_reference_heads, 0xFF, heads_size * sizeof(u32));
+
+  state->back_reference_chains = malloc(input_length * sizeof(u32));
+  memset(state->back_reference_chains + input_length - 3, 0xFF, 3 * sizeof(u32));
+
+  state->back_reference_matches = malloc(input_length * sizeof(back_reference_match));
+  memset(state->back_reference_matches, 0xFF, input_length * sizeof(back_reference_match));
+
+  for (u32 i = 0; i + 3 < input_length; ++i) {
+    const u32 hash = back_reference_hash(state, input->data + i);
+    state->back_reference_chains[i] = state->back_reference_heads[hash];
+    state->back_reference_heads[hash] = i;
+  }
 }
 
-compress_option check_jumping_segment(FILE *input, u32 coverage_limit)
+void delete_back_reference_chains(compress_state *state)
 {
-  if (coverage_limit < 2) { return (compress_option){0}; }
-  coverage_limit = coverage_limit > 512 ? 512 : coverage_limit;
+  free(state->back_reference_heads);
+  state->back_reference_heads = NULL;
 
-  const i32 pos = ftell(input);
+  free(state->back_reference_chains);
+  state->back_reference_chains = NULL;
 
-  u8 value = getc(input);
-  const u8 offset = (value & 0xF0) + (((value & 0x0F) > 8) << 4);
+  free(state->back_reference_matches);
+  state->back_reference_matches = NULL;
+}
 
-  i16 count = 1;
-  while (count < coverage_limit) {
-    const u8 ch = getc(input);
-    const u8 diff = (u8)(ch - value) < (u8)(value - ch) ? (ch - value) : (value - ch);
-    if (value == ch || diff > 8) { break; }
+// the index of a dictionary token, BACK_REFERENCE_INDEX for a back-reference; the data of an
+// option are bytes, so it's copied out rather than read through a u16 pointer
+u16 option_dictionary_index(const compress_option *co)
+{
+  u16 index_and_fn;
+  memcpy(&index_and_fn, co->data, sizeof(u16));
+  return index_and_fn >> 4;
+}
 
-    value = ch;
-    count++;
+// a dictionary item is written once and paid for by all of its uses, so its share of a use
+// is counted as well: the item is spread over the occurrences the dictionary was built from,
+// or over the uses it already has once there are more of them
+double option_cost(const compress_state *state, const compress_option *co)
+{
+  if (co->fn != FN_DICTIONARY || state->shared_dictionary) { return co->length; }
+
+  const u16 index = option_dictionary_index(co);
+  if (index == BACK_REFERENCE_INDEX) { return co->length; }
+
+  const compress_dictionary_item *const item = state->compress_dictionary + index;
+  const u32 uses = item->usage_count + 1 > item->repeat_count ? item->usage_count + 1 : item->repeat_count;
+  return co->length + (double)(item->length & 0x7FFF) / uses;
+}
+
+void count_dictionary_use(compress_state *state, const compress_option *co)
+{
+  if (co->fn != FN_DICTIONARY || state->shared_dictionary) { return; }
+
+  const u16 index = option_dictionary_index(co);
+  if (index == BACK_REFERENCE_INDEX) { return; }
+
+  if (state->usage_counts) {
+    state->usage_counts[index]++;
+  } else {
+    state->compress_dictionary[index].usage_count++;
+  }
+}
+
+// The optimal parse can't know how many times a dictionary item will end up used, so every
+// use is priced as one of two, its bytes as average literals.
+double parse_cost(const compress_state *state, const compress_option *co)
+{
+  double cost = state->byte_costs[TS_OPCODES][co->data[0]];
+  for (u32 i = 1; i < co->length; ++i) {
+    cost += state->byte_costs[TS_PARAMETERS][co->data[i]];
   }
 
-  fseek(input, pos, SEEK_SET);
+  if (co->fn != FN_DICTIONARY || state->shared_dictionary) { return cost; }
 
-  count /= 2;
-  if (count < 2) { return (compress_option){0}; }
+  const u16 index = option_dictionary_index(co);
+  if (index == BACK_REFERENCE_INDEX) { return cost; }
 
-  const compress_option co = {FN_JUMPING_SEGMENT, 0, malloc((count + 2) * sizeof(u8)), count + 2, count * 2};
-  co.data[0] = offset + FN_JUMPING_SEGMENT;
-  co.data[1] = count - 1;
+  return cost + (state->compress_dictionary[index].length & 0x7FFF) * state->mean_byte_costs[TS_LITERALS] / 2;
+}
+
+// what skipping 'skip_length' bytes costs with the headers written by perform_compression
+u32 skip_cost(u32 skip_length)
+{
+  if (!skip_length) { return 0; }
 
-  value = offset;
-  for (u16 i = 2; count-- > 0; i++) {
-    i8 pair[2];
+  const u32 long_skips_count = (skip_length - 1) / 4096;
+  const u32 rest = skip_length - long_skips_count * 4096;
+  return skip_length + long_skips_count * 2 + (rest > 16 ? 2 : 1);
+}
 
-    for (u8 j = 0; j < 2; ++j) {
-      const u8 ch = getc(input);
+// Bytes are priced by their entropy in the sections of some tokens, or as one byte each when
+// 'sections' is NULL. A byte that isn't in its section is priced as the longest Huffman code.
+// Returns what the tokens are expected to take once entropy coded.
+double price_bytes(compress_state *state, const byte_buffer *sections)
+{
+  double total_cost = 0;
+  for (u8 section = 0; section < TOKEN_SECTIONS_COUNT; ++section) {
+    double *const costs = state->byte_costs[section];
 
-      if (abs(ch - value) > 8) {
-        pair[j] = value > ch ? (u8)(ch - value) : -(u8)(value - ch);
-      } else {
-        pair[j] = ch - value;
+    if (!sections || !sections[section].size) {
+      for (u16 i = 0; i < 256; ++i) {
+        costs[i] = 1;
       }
 
-      pair[j] = (pair[j] + 8 - (pair[j] > 0));
-      value = ch;
+      state->mean_byte_costs[section] = 1;
+      continue;
     }
 
-    co.data[i] = (pair[0] << 4) + (pair[1] & 0x0F);
+    const byte_buffer *const bytes = sections + section;
+    u32 counts[256] = {0};
+    for (u32 i = 0; i < bytes->size; ++i) {
+      counts[bytes->data[i]]++;
+    }
+
+    double section_cost = 0;
+    for (u16 i = 0; i < 256; ++i) {
+      const double bits = counts[i] ? binary_log((double)bytes->size / counts[i]) : BP_BITS_MAX;
+      costs[i] = (bits < BP_BITS_MAX ? bits : BP_BITS_MAX) / 8;
+      section_cost += counts[i] * costs[i];
+    }
+
+    state->mean_byte_costs[section] = section_cost / bytes->size;
+    total_cost += section_cost;
   }
 
-  return co;
+  return total_cost;
+}
+
+// log2 of x >= 1 to a few fractional bits, without libm: every squaring of the mantissa
+// gives the next bit
+double binary_log(double x)
+{
+  double result = 0;
+  for (; x >= 2; x /= 2) {
+    result++;
+  }
+
+  for (double bit = 0.5; bit >= 1.0 / 256; bit /= 2) {
+    x *= x;
+    if (x >= 2) {
+      x /= 2;
+      result += bit;
+    }
+  }
+
+  return result;
 }
 
-void perform_compression(FILE *input, FILE *output)
+// every pass takes, from left to right, the most profitable option at each offset not yet
+// covered, as long as it's worth the current profit limit, which halves after every pass
+u32 parse_greedy(compress_state *state, const byte_buffer *input)
 {
-  fseek(input, 0, SEEK_END);
-  const u32 input_length = ftell(input);
+  const u32 input_length = input->size;
   double profit_limit = input_length > 8 ? (double)input_length / 8 : input_length;
-  rewind(input);
 
-  u32 options_capacity = 256;
-  compress_option *options = malloc(options_capacity * sizeof(compress_option));
+  options_reserve(&state->options, &state->options_capacity, 1);
   u32 options_size = 0;
 
   while (profit_limit >= 1) {
-    const u32 current_options_size = options_size;
+    const compress_option *const options = state->options;
+    u32 pass_options_size = 0;
 
-    i16 ch;
-    while ((ch = getc(input)) != EOF) {
-      ungetc(ch, input);
+    // the options of the previous passes are walked along with the offset, which never lands
+    // inside one of them, so the next one is always the one at or after the offset
+    u32 next_option = 0;
 
-      const i32 offset = ftell(input);
+    u32 offset = 0;
+    while (offset < input_length) {
       u32 coverage_limit = input_length - offset;
 
-      {
-        next_comparison_option.fn = 0;
-        const compress_option key_option = {.offset = offset};
-        const compress_option *const found_option =
-          bsearch(&key_option, options, current_options_size, sizeof(compress_option), options_compare);
-
-        if (found_option) {
-          fseek(input, found_option->coverage, SEEK_CUR);
+      if (next_option < options_size) {
+        if (options[next_option].offset == offset) {
+          offset += options[next_option++].coverage;
           continue;
         }
 
-        if (next_comparison_option.fn) {
-          coverage_limit = next_comparison_option.offset - offset;
-        }
+        coverage_limit = options[next_option].offset - offset;
       }
 
       compress_option best_co = {.length = 1};
-      for (u8 i = 2; i < 0x10; ++i) {
-        fseek(input, offset, SEEK_SET);
+      for (u8 i = 2; i < sizeof(CHECK_FUNCTIONS) / sizeof(*CHECK_FUNCTIONS); ++i) {
+        if (!(state->level->checks & (1u << i))) { continue; }
 
-        const compress_option co = CHECK_FUNCTIONS[i](input, coverage_limit);
+        const compress_option co = CHECK_FUNCTIONS[i](state, input, offset, coverage_limit);
+        state->stats.tokens[i].checks_count++;
         if (!co.fn) { continue; }
 
-        const double co_profit = (double)co.coverage / co.length;
-        if (co_profit < profit_limit) {
-          free(co.data);
-          continue;
-        }
-
-        const double best_co_profit = (double)best_co.coverage / best_co.length;
-        if (co_profit > best_co_profit) {
-          free(best_co.data);
-          best_co = co;
-          continue;
-        }
+        const double co_profit = co.coverage / option_cost(state, &co);
+        if (co_profit < profit_limit) { continue; }
 
-        free(co.data);
+        const double best_co_profit = best_co.coverage / option_cost(state, &best_co);
+        if (co_profit > best_co_profit) { best_co = co; }
       }
 
       if (best_co.fn) {
         best_co.offset = offset;
-        options[options_size++] = best_co;
-        if (options_size >= options_capacity) {
-          options_capacity *= 2;
-          options = realloc(options, options_capacity * sizeof(compress_option));
-        }
+        options_reserve(&state->pass_options, &state->pass_options_capacity, pass_options_size + 1);
+        state->pass_options[pass_options_size++] = best_co;
 
-        if (best_co.fn == FN_DICTIONARY) {
-          const u16 index = *(u16 *)best_co.data >> 4;
-          compress_dictionary[index].usage_count++;
-        }
+        count_dictionary_use(state, &best_co);
       }
 
-      fseek(input, offset + (best_co.fn ? best_co.coverage : 1), SEEK_SET);
+      offset += best_co.fn ? best_co.coverage : 1;
     }
 
-    qsort(options, options_size, sizeof(compress_option), options_compare);
-    rewind(input);
+    merge_options(state, options_size, pass_options_size);
+    options_size += pass_options_size;
     profit_limit /= 2;
   }
 
-  fseek(input, 0, SEEK_END);
-  options[options_size++] = (compress_option){.offset = ftell(input)};
-  rewind(input);
+  return options_size;
+}
+
+void count_segment(compress_state *state, u32 checks)
+{
+  state->stats.segments_count++;
+  for (u8 i = 2; i < sizeof(CHECK_FUNCTIONS) / sizeof(*CHECK_FUNCTIONS); ++i) {
+    state->stats.check_segments_count[i - 2] += (checks >> i) & 1;
+  }
+}
+
+// The cheapest parse of the whole input: the candidates of every offset are checked once,
+// and each offset keeps the cheapest way found to reach it, either by a token or by one more
+// skipped byte. The chosen tokens are then collected back from the end. A token covering
+// PO_LONG_COVERAGE bytes or more is taken right away and the offsets under it aren't checked,
+// which keeps long runs from being scanned at every one of their bytes.
+u32 parse_optimal(compress_state *state, const byte_buffer *input)
+{
+  const u32 input_length = input->size;
+  if (input_length + 1 > state->parse_nodes_capacity) {
+    state->parse_nodes_capacity = input_length + 1;
+    state->parse_nodes = realloc(state->parse_nodes, state->parse_nodes_capacity * sizeof(parse_node));
+  }
+
+  parse_node *const nodes = state->parse_nodes;
+  nodes[0] = (parse_node){0, 0, 0, 0};
+  for (u32 i = 1; i <= input_length; ++i) {
+    nodes[i].price = HUGE_VAL;
+  }
+
+  // bytes covered by each check in the segment being probed
+  u32 check_wins[sizeof(CHECK_FUNCTIONS) / sizeof(*CHECK_FUNCTIONS)] = {0};
+  u32 checks = state->level->checks;
+  u32 segment = 0;
+  bool probing = true;
+  count_segment(state, checks);
+
+  for (u32 offset = 0; offset < input_length;) {
+    const parse_node *const node = nodes + offset;
+
+    // a token is credited to the segment it starts in, even when it ends past it, as the long
+    // ones taken right away do
+    if (probing && node->from / CP_SEGMENT_LENGTH == segment) { check_wins[node->check] += offset - node->from; }
+
+    // a probe tries every check of the level, the segments up to the next probe only try the
+    // checks that covered more than a negligible share of it
+    if (offset / CP_SEGMENT_LENGTH != segment) {
+      if (probing && state->level->prune_checks) {
+        checks = state->level->checks & CP_KEPT_CHECKS;
+        for (u8 i = 2; i < sizeof(CHECK_FUNCTIONS) / sizeof(*CHECK_FUNCTIONS); ++i) {
+          if (check_wins[i] * CP_WIN_SHARE >= CP_SEGMENT_LENGTH) { checks |= 1u << i; }
+        }
+      }
+
+      segment = offset / CP_SEGMENT_LENGTH;
+      probing = !(segment % CP_PROBE_INTERVAL);
+      if (probing) {
+        checks = state->level->checks;
+        memset(check_wins, 0, sizeof(check_wins));
+      }
+
+      count_segment(state, checks);
+    }
+
+    {
+      // the headers of the skip, then the byte skipped
+      const u32 skip_length = node->skip_length + 1;
+      const double price = node->price +
+                           (skip_cost(skip_length) - skip_cost(skip_length - 1) - 1) * state->mean_byte_costs[TS_OPCODES] +
+                           state->byte_costs[TS_LITERALS][input->data[offset]];
+      if (price <= nodes[offset + 1].price) { nodes[offset + 1] = (parse_node){price, offset, skip_length, 0}; }
+    }
+
+    u32 long_coverage = 0;
+    for (u8 i = 2; i < sizeof(CHECK_FUNCTIONS) / sizeof(*CHECK_FUNCTIONS); ++i) {
+      if (!(checks & (1u << i))) { continue; }
+
+      const compress_option co = CHECK_FUNCTIONS[i](state, input, offset, input_length - offset);
+      state->stats.tokens[i].checks_count++;
+      if (!co.fn) { continue; }
+
+      const double price = node->price + parse_cost(state, &co);
+      if (price < nodes[offset + co.coverage].price) { nodes[offset + co.coverage] = (parse_node){price, offset, 0, i}; }
+      if (co.coverage >= PO_LONG_COVERAGE && co.coverage >= co.length * PO_LONG_RATIO && co.coverage > long_coverage) {
+        long_coverage = co.coverage;
+      }
+    }
+
+    if (!long_coverage) {
+      offset++;
+      continue;
+    }
+
+    // the end of a long token was already priced by it, parsing goes on from there
+    offset += long_coverage;
+  }
+
+  u32 options_size = 0;
+  for (u32 offset = input_length; offset; offset = nodes[offset].from) {
+    options_size += nodes[offset].check != 0;
+  }
+
+  options_reserve(&state->options, &state->options_capacity, options_size + 1);
 
+  u32 i = options_size;
+  for (u32 offset = input_length; offset; offset = nodes[offset].from) {
+    if (!nodes[offset].check) { continue; }
+
+    const u32 from = nodes[offset].from;
+    compress_option co = CHECK_FUNCTIONS[nodes[offset].check](state, input, from, input_length - from);
+    co.offset = from;
+    state->options[--i] = co;
+    count_dictionary_use(state, &co);
+  }
+
+  return options_size;
+}
+
+u8 option_token(const compress_option *co)
+{
+  if (co->fn == FN_DICTIONARY && option_dictionary_index(co) == BACK_REFERENCE_INDEX) { return BCZIP_TOKENS_COUNT - 1; }
+  return co->fn;
+}
+
+// the tokens written are counted in 'tokens', unless it's NULL
+void perform_compression(compress_state *state, const byte_buffer *input, byte_buffer *output, bczip_token_stats *tokens)
+{
+  const u32 input_length = input->size;
+
+  create_back_reference_chains(state, input);
+  u32 options_size = state->level->optimal_parse ? parse_optimal(state, input) : parse_greedy(state, input);
+  delete_back_reference_chains(state);
+
+  compress_option *const options = state->options;
+  options[options_size++] = (compress_option){.offset = input_length};
+
+  u32 offset = 0;
   for (u32 i = 0; i < options_size; ++i) {
-    u32 skip_length = options[i].offset - ftell(input);
+    u32 skip_length = options[i].offset - offset;
 
     while (skip_length) {
       if (skip_length > 4096) {
         const u16 skip_length_buff = 0xFFF0 + FN_SKIP_LONG;
-        fwrite(&skip_length_buff, sizeof(u16), 1, output);
+        buffer_write(output, &skip_length_buff, sizeof(u16));
+        if (tokens) {
+          tokens[FN_SKIP_LONG].count++;
+          tokens[FN_SKIP_LONG].covered_bytes += 4096;
+        }
 
         for (u16 j = 0; j < 4096; ++j) {
-          putc(getc(input), output);
+          buffer_put(output, buffer_get(input, offset++));
         }
 
         skip_length -= 4096;
@@ -632,13 +1182,24 @@ void perform_compression(FILE *input, FILE *output)
 
       if (skip_length > 16) {
         const u16 skip_length_buff = ((skip_length - 1) << 4) + FN_SKIP_LONG;
-        fwrite(&skip_length_buff, sizeof(u16), 1, output);
+        buffer_write(output, &skip_length_buff, sizeof(u16));
       } else {
-        putc(((skip_length - 1) << 4) + FN_SKIP, output);
+        buffer_put(output, ((skip_length - 1) << 4) + FN_SKIP);
+      }
+
+      if (tokens) {
+        tokens[skip_length > 16 ? FN_SKIP_LONG : FN_SKIP].count++;
+        tokens[skip_length > 16 ? FN_SKIP_LONG : FN_SKIP].covered_bytes += skip_length;
+      }
+
+      if (offset + skip_length <= input_length) {
+        buffer_write(output, input->data + offset, skip_length);
+        offset += skip_length;
+        break;
       }
 
       while (skip_length--) {
-        putc(getc(input), output);
+        buffer_put(output, buffer_get(input, offset++));
       }
 
       break;
@@ -646,238 +1207,350 @@ void perform_compression(FILE *input, FILE *output)
 
     if (!options[i].fn) { continue; }
 
-    fwrite(options[i].data, sizeof(u8), options[i].length, output);
-    free(options[i].data);
-    fseek(input, options[i].coverage, SEEK_CUR);
-  }
+    if (tokens) {
+      tokens[option_token(options + i)].count++;
+      tokens[option_token(options + i)].covered_bytes += options[i].coverage;
+    }
+
+    buffer_write(output, options[i].data, options[i].length);
 
-  free(options);
+    offset += options[i].coverage;
+  }
 }
 
-void create_compress_dictionary(FILE *input)
+// A level parsing for the entropy coder parses a second time, with the bytes priced by the
+// sections of the tokens of the first parse, and keeps the tokens that are expected to be
+// entropy coded smaller.
+// Such a level has no dictionary of its own, whose usage the second parse would count again.
+void parse_block(compress_block *block, bczip_token_stats *tokens)
 {
-  for (u16 i = 0; i < 256; ++i) {
-    u32 parts_count = 0;
-    {
-      rewind(input);
-      i16 ch;
-
-      while ((ch = getc(input)) != EOF) {
-        if (ch == i) { parts_count++; }
-      }
-    }
-
-    if (parts_count < 2) { continue; }
+  compress_state *const state = &block->state;
+  if (!state->level->entropy_parse) {
+    perform_compression(state, &block->input, &block->tokens, tokens);
+    return;
+  }
 
-    i16 **const parts = calloc(parts_count, sizeof(i16 *));
-    {
-      rewind(input);
-      i16 ch;
+  bczip_token_stats first_tokens[BCZIP_TOKENS_COUNT] = {0};
+  perform_compression(state, &block->input, &block->tokens, first_tokens);
+  split_tokens(block->tokens.data, block->tokens.size, block->sections);
+  const double first_cost = price_bytes(state, block->sections);
+
+  byte_buffer *const first = &block->alternative_tokens;
+  const byte_buffer swap = *first;
+  *first = block->tokens;
+  block->tokens = swap;
+  block->tokens.size = 0;
+
+  bczip_token_stats second_tokens[BCZIP_TOKENS_COUNT] = {0};
+  perform_compression(state, &block->input, &block->tokens, second_tokens);
+  split_tokens(block->tokens.data, block->tokens.size, block->sections);
+  const double second_cost = price_bytes(state, block->sections);
+  price_bytes(state, NULL);
+
+  if (first_cost < second_cost) {
+    const byte_buffer second = block->tokens;
+    block->tokens = *first;
+    *first = second;
+  }
 
-      u32 last_ch_offset = 0;
-      while ((ch = getc(input)) != EOF) {
-        if (ch == i) { break; }
-        last_ch_offset++;
-      }
+  const bczip_token_stats *const kept = first_cost < second_cost ? first_tokens : second_tokens;
+  for (u32 i = 0; i < BCZIP_TOKENS_COUNT; ++i) {
+    tokens[i].count += kept[i].count;
+    tokens[i].covered_bytes += kept[i].covered_bytes;
+  }
+}
 
-      u32 parts_i = 0;
-      do {
-        ch = getc(input);
-        if (ch != i && ch != EOF) { continue; }
-        if (ch != EOF) { ungetc(ch, input); }
+void create_compress_dictionary(compress_state *state, const byte_buffer *input)
+{
+  const u32 input_length = input->size;
+  if (input_length < 2) { return; }
 
-        i32 length = ftell(input) - last_ch_offset;
-        parts[parts_i] = malloc((length + 1) * sizeof(i16));
-        parts[parts_i][length] = EOF;
+  u32 *const suffix_array = malloc((input_length + 1) * sizeof(u32));
+  u32 *const lcp_array = malloc(input_length * sizeof(u32));
 
-        fseek(input, -length, SEEK_CUR);
-        for (u32 j = 0; j < length; ++j) {
-          parts[parts_i][j] = getc(input);
-        }
+  create_suffix_array(input->data, input_length, suffix_array);
+  create_lcp_array(input->data, input_length, suffix_array, lcp_array);
 
-        parts_i++;
-        last_ch_offset = ftell(input);
-        fseek(input, 1, SEEK_CUR);
-      } while (ch != EOF);
+  // every part starts with some byte and ends right before the next occurrence of that byte
+  u32 *const part_lengths = malloc(input_length * sizeof(u32));
+  {
+    u32 next_offsets[256];
+    for (u16 i = 0; i < 256; ++i) {
+      next_offsets[i] = input_length;
     }
 
-    qsort(parts, parts_count, sizeof(i16 *), parts_compare);
-
-    for (u32 parts_i = 1; parts_i < parts_count; ++parts_i) {
-      u32 length = 0;
-      while (parts[parts_i - 1][length] == parts[parts_i][length] && parts[parts_i][length] != EOF) {
-        length++;
-      }
-
-      if (length < CD_ITEM_LENGTH_LIMIT || length > 0xFFFF) {
-        free(parts[parts_i - 1]);
-        parts[parts_i - 1] = NULL;
-        continue;
-      }
-
-      if (parts[parts_i - 1][length] != EOF) {
-        parts[parts_i - 1] = realloc(parts[parts_i - 1], (length + 1) * sizeof(i16));
-        parts[parts_i - 1][length] = EOF;
-      }
+    for (u32 i = input_length; i-- > 0;) {
+      part_lengths[i] = next_offsets[input->data[i]] - i;
+      next_offsets[input->data[i]] = i;
     }
+  }
 
-    u32 actual_parts_count = 0;
-    {
-      u32 parts_i = 0;
-      while (parts[parts_i] == NULL) {
-        parts_i++;
-      }
+  compress_dictionary_part *const parts = malloc((input_length / 2 + 1) * sizeof(compress_dictionary_part));
 
-      u32 last_parts_i = parts_i++;
-      while (parts_i < parts_count) {
-        actual_parts_count++;
+  // parts starting with the same byte are adjacent in the suffix array and already sorted, the
+  // common prefix of two neighbours is their LCP cut to the shorter part. Every run of neighbours
+  // sharing at least CD_ITEM_LENGTH_LIMIT bytes gives a single item: the prefix common to the
+  // whole run, so that it matches every part of the run instead of just one pair of them
+  for (u32 group_start = 0, group_end; group_start < input_length; group_start = group_end) {
+    const u8 ch = input->data[suffix_array[group_start]];
 
-        while (parts[parts_i] == NULL) {
-          parts_i++;
-        }
+    group_end = group_start + 1;
+    while (group_end < input_length && input->data[suffix_array[group_end]] == ch) {
+      group_end++;
+    }
 
-        u32 part_length = 0;
-        while (parts[parts_i][part_length] != EOF) {
-          part_length++;
-        }
+    u32 parts_count = 0;
+    for (u32 rank = group_start + 1; rank < group_end; ++rank) {
+      const u32 run_start = rank - 1;
+      u32 length = 0xFFFFFFFF;
 
-        if (parts_i < parts_count - 1 && !memcmp(parts[last_parts_i], parts[parts_i], part_length * sizeof(i16))) {
-          actual_parts_count--;
-          free(parts[last_parts_i]);
-          parts[last_parts_i] = NULL;
-        }
+      for (; rank < group_end; ++rank) {
+        u32 common_length = lcp_array[rank];
+        if (part_lengths[suffix_array[rank - 1]] < common_length) { common_length = part_lengths[suffix_array[rank - 1]]; }
+        if (part_lengths[suffix_array[rank]] < common_length) { common_length = part_lengths[suffix_array[rank]]; }
 
-        last_parts_i = parts_i++;
+        if (common_length < CD_ITEM_LENGTH_LIMIT) { break; }
+        if (common_length < length) { length = common_length; }
       }
 
-      free(parts[--parts_count]);
+      if (rank - run_start < 2 || length > 0x7FFF) { continue; }
+      parts[parts_count++] = (compress_dictionary_part){input->data + suffix_array[run_start], length, rank - run_start};
     }
 
-    if (!actual_parts_count) {
-      free(parts);
-      continue;
-    }
+    if (!parts_count) { continue; }
+    if (state->compress_dictionary_size + parts_count > 0xFFF) { break; }
 
-    if (compress_dictionary_size + actual_parts_count > 0xFFF) {
-      while (parts_count) {
-        free(parts[--parts_count]);
-      }
-      free(parts);
-      break;
-    }
+    u16 cdi = state->compress_dictionary_size;
+    state->compress_dictionary_size += parts_count;
+    state->compress_dictionary = realloc(state->compress_dictionary, state->compress_dictionary_size * sizeof(compress_dictionary_item));
 
-    {
-      u16 cdi = compress_dictionary_size;
-      compress_dictionary_size += actual_parts_count;
-      compress_dictionary = realloc(compress_dictionary, compress_dictionary_size * sizeof(compress_dictionary_item));
+    for (u32 parts_i = 0; parts_i < parts_count; ++parts_i, ++cdi) {
+      state->compress_dictionary[cdi].length = parts[parts_i].length;
+      state->compress_dictionary[cdi].data = malloc(state->compress_dictionary[cdi].length * sizeof(u8));
+      memcpy(state->compress_dictionary[cdi].data, parts[parts_i].data, state->compress_dictionary[cdi].length * sizeof(u8));
 
-      for (u32 parts_i = 0; actual_parts_count--; ++cdi) {
-        while (parts[parts_i] == NULL) {
-          parts_i++;
-        }
+      state->compress_dictionary[cdi].usage_count = 0;
+      state->compress_dictionary[cdi].repeat_count = parts[parts_i].repeat_count;
+      state->compress_dictionary[cdi].index = cdi;
+    }
+  }
 
-        compress_dictionary[cdi].length = 0;
-        while (parts[parts_i][compress_dictionary[cdi].length] != EOF) {
-          compress_dictionary[cdi].length++;
-        }
+  free(parts);
+  free(part_lengths);
+  free(lcp_array);
+  free(suffix_array);
 
-        compress_dictionary[cdi].data = malloc(compress_dictionary[cdi].length * sizeof(u8));
-        for (u32 j = 0; j < compress_dictionary[cdi].length; ++j) {
-          compress_dictionary[cdi].data[j] = parts[parts_i][j];
-        }
+  create_compress_dictionary_index(state);
+}
 
-        compress_dictionary[cdi].usage_count = 0;
-        compress_dictionary[cdi].index = cdi;
-        free(parts[parts_i++]);
-      }
-    }
+void compress_dictionary_items_task(void *task_pointer)
+{
+  dictionary_items_task *const task = task_pointer;
+  compress_state *const state = &task->state;
+
+  for (u32 i = task->first; i < task->items_count; i += task->tasks_count) {
+    // an item can only refer to the items written before it, items used once aren't written at all
+    state->compress_dictionary_size = i < task->written_items_count ? i : task->written_items_count;
 
-    free(parts);
+    const byte_buffer item_input = {state->compress_dictionary[i].data, state->compress_dictionary[i].length, state->compress_dictionary[i].length};
+    perform_compression(state, &item_input, task->outputs + i, NULL);
   }
 }
 
-void optimize_compress_dictionary(u16 *new_dictionary_indexes)
+void optimize_compress_dictionary(compress_state *state, u16 *new_dictionary_indexes, thread_pool *pool,
+                                  u32 threads_count)
 {
-  qsort(compress_dictionary, compress_dictionary_size,
+  qsort(state->compress_dictionary, state->compress_dictionary_size,
         sizeof(compress_dictionary_item), dictionary_items_usage_count_compare);
 
   u16 ucgto_size = 0;
-  while (ucgto_size < compress_dictionary_size && compress_dictionary[ucgto_size].usage_count > 1) {
+  while (ucgto_size < state->compress_dictionary_size && state->compress_dictionary[ucgto_size].usage_count > 1) {
     ucgto_size++;
   }
 
   u16 ucgtz_size = ucgto_size;
-  while (ucgtz_size < compress_dictionary_size && compress_dictionary[ucgtz_size].usage_count > 0) {
+  while (ucgtz_size < state->compress_dictionary_size && state->compress_dictionary[ucgtz_size].usage_count > 0) {
     ucgtz_size++;
   }
 
-  qsort(compress_dictionary, ucgto_size, sizeof(compress_dictionary_item), dictionary_items_length_compare);
-  qsort(compress_dictionary + ucgto_size, ucgtz_size - ucgto_size,
+  qsort(state->compress_dictionary, ucgto_size, sizeof(compress_dictionary_item), dictionary_items_length_compare);
+  qsort(state->compress_dictionary + ucgto_size, ucgtz_size - ucgto_size,
         sizeof(compress_dictionary_item), dictionary_items_length_compare);
 
-  const u16 cds_buff = compress_dictionary_size;
+  delete_compress_dictionary_index(state);
+  create_compress_dictionary_index(state);
+
+  const u16 cds = state->compress_dictionary_size;
+  const u16 tasks_count = !pool || threads_count < 2 ? 1 : threads_count < ucgtz_size ? threads_count : ucgtz_size;
+  dictionary_items_task *const tasks = calloc(tasks_count, sizeof(dictionary_items_task));
+  byte_buffer *const outputs = calloc(ucgtz_size, sizeof(byte_buffer));
+
+  for (u16 t = 0; t < tasks_count; ++t) {
+    dictionary_items_task *const task = tasks + t;
+    task->first = t;
+    task->tasks_count = tasks_count;
+    task->items_count = ucgtz_size;
+    task->written_items_count = ucgto_size;
+    task->outputs = outputs;
+
+    // the items and their index are shared and only read, the index only ever points to the
+    // uncompressed items
+    compress_state *const task_state = &task->state;
+    task_state->window_log = state->window_log;
+    task_state->level = state->level;
+    task_state->compress_dictionary = state->compress_dictionary;
+    task_state->usage_counts = calloc(cds, sizeof(u32));
+    task_state->compress_dictionary_index = state->compress_dictionary_index;
+    task_state->compress_dictionary_index_heads = state->compress_dictionary_index_heads;
+    task_state->compress_dictionary_index_bits = state->compress_dictionary_index_bits;
+    price_bytes(task_state, NULL);
+
+    if (tasks_count > 1) {
+      thread_pool_submit(pool, compress_dictionary_items_task, task);
+    } else {
+      compress_dictionary_items_task(task);
+    }
+  }
 
-  for (u16 i = 0; i < ucgtz_size; ++i) {
-    new_dictionary_indexes[compress_dictionary[i].index] = i;
-    compress_dictionary_size = i;
+  if (tasks_count > 1) { thread_pool_wait(pool); }
 
-    FILE *const input_tmp = tmpfile();
-    FILE *const output_tmp = tmpfile();
+  // the new uses are only added once every item has been compressed
+  for (u16 t = 0; t < tasks_count; ++t) {
+    compress_state *const task_state = &tasks[t].state;
+    for (u16 i = 0; i < cds; ++i) {
+      state->compress_dictionary[i].usage_count += task_state->usage_counts[i];
+    }
 
-    fwrite(compress_dictionary[i].data, sizeof(u8), compress_dictionary[i].length, input_tmp);
-    perform_compression(input_tmp, output_tmp);
+    add_compress_stats(&state->stats, &task_state->stats, false);
+    free(task_state->usage_counts);
+    free(task_state->options);
+    free(task_state->pass_options);
+    free(task_state->parse_nodes);
+  }
 
-    const u16 output_tmp_length = ftell(output_tmp);
-    if (output_tmp_length < compress_dictionary[i].length || compress_dictionary[i].usage_count == 1) {
-      compress_dictionary[i].data = realloc(compress_dictionary[i].data, output_tmp_length);
-      compress_dictionary[i].length = output_tmp_length | 0x8000;
+  for (u16 i = 0; i < ucgtz_size; ++i) {
+    new_dictionary_indexes[state->compress_dictionary[i].index] = i;
 
-      rewind(output_tmp);
-      fread(compress_dictionary[i].data, sizeof(u8), output_tmp_length, output_tmp);
+    const u16 item_output_length = outputs[i].size;
+    if (item_output_length < state->compress_dictionary[i].length || state->compress_dictionary[i].usage_count == 1) {
+      free(state->compress_dictionary[i].data);
+      state->compress_dictionary[i].data = outputs[i].data;
+      state->compress_dictionary[i].length = item_output_length | 0x8000;
+      continue;
     }
 
-    fclose(input_tmp);
-    fclose(output_tmp);
+    free(outputs[i].data);
   }
 
-  compress_dictionary_size = cds_buff;
+  delete_compress_dictionary_index(state);
+  free(outputs);
+  free(tasks);
+}
+
+void delete_compress_dictionary(compress_state *state)
+{
+  delete_compress_dictionary_index(state);
+
+  for (u16 i = 0; i < state->compress_dictionary_size; ++i) {
+    free(state->compress_dictionary[i].data);
+  }
+
+  free(state->compress_dictionary);
+  state->compress_dictionary = NULL;
+  state->compress_dictionary_size = 0;
+}
+
+u64 dictionary_key(const u8 *data)
+{
+  u64 key;
+  memcpy(&key, data, sizeof(u64));
+  return key;
 }
 
-void delete_compress_dictionary(void)
+u32 dictionary_key_slot(const compress_state *state, u64 key)
 {
-  for (u16 i = 0; i < compress_dictionary_size; ++i) {
-    free(compress_dictionary[i].data);
+  return (key * 0x9E3779B97F4A7C15) >> (64 - state->compress_dictionary_index_bits);
+}
+
+void create_compress_dictionary_index(compress_state *state)
+{
+  if (!state->compress_dictionary_size) { return; }
+
+  state->compress_dictionary_index_bits = 1;
+  while ((1u << state->compress_dictionary_index_bits) < state->compress_dictionary_size * 2u) {
+    state->compress_dictionary_index_bits++;
+  }
+
+  const u32 heads_size = 1u << state->compress_dictionary_index_bits;
+  state->compress_dictionary_index_heads = malloc(heads_size * sizeof(u16));
+  memset(state->compress_dictionary_index_heads, 0xFF, heads_size * sizeof(u16));
+
+  state->compress_dictionary_index = malloc(state->compress_dictionary_size * sizeof(compress_dictionary_index_item));
+
+  for (u16 i = 0; i < state->compress_dictionary_size; ++i) {
+    compress_dictionary_index_item *const item = state->compress_dictionary_index + i;
+    *item = (compress_dictionary_index_item){
+      state->compress_dictionary[i].data, dictionary_key(state->compress_dictionary[i].data), state->compress_dictionary[i].length, i, CD_INDEX_END,
+    };
+
+    u16 *link = state->compress_dictionary_index_heads + dictionary_key_slot(state, item->key);
+    while (*link != CD_INDEX_END && state->compress_dictionary_index[*link].length > item->length) {
+      link = &state->compress_dictionary_index[*link].next;
+    }
+
+    item->next = *link;
+    *link = i;
   }
+}
 
-  free(compress_dictionary);
-  compress_dictionary = NULL;
-  compress_dictionary_size = 0;
+void delete_compress_dictionary_index(compress_state *state)
+{
+  free(state->compress_dictionary_index_heads);
+  state->compress_dictionary_index_heads = NULL;
+
+  free(state->compress_dictionary_index);
+  state->compress_dictionary_index = NULL;
 }
 
-void write_compress_dictionary(FILE *output)
+// A stream compressed with a shared dictionary has version 0xC and stores the dictionary's id
+// instead of items: 8[0xBC] 12[0] 4[0xC] 8[window_log] 32[dictionary id]
+void write_compress_dictionary(const compress_state *state, byte_buffer *output)
 {
+  if (state->shared_dictionary) {
+    buffer_put(output, 0xBC);
+    const u16 header = 0xC;
+    buffer_write(output, &header, sizeof(u16));
+    buffer_put(output, state->window_log);
+    buffer_write(output, &state->dictionary_id, sizeof(u32));
+    return;
+  }
+
   u16 cds = 0;
-  while (cds < compress_dictionary_size && compress_dictionary[cds].usage_count > 1) {
+  while (cds < state->compress_dictionary_size && state->compress_dictionary[cds].usage_count > 1) {
     cds++;
   }
 
-  putc(0xBC, output); // write first MAGIC_HEADER part
-  const u16 cds_with_second_magic_header_part = (cds << 4) + 0x9;
-  fwrite(&cds_with_second_magic_header_part, sizeof(u16), 1, output);
+  buffer_put(output, 0xBC); // write first MAGIC_HEADER part
+  const u16 cds_with_second_magic_header_part = (cds << 4) + 0xA;
+  buffer_write(output, &cds_with_second_magic_header_part, sizeof(u16));
+  buffer_put(output, state->window_log);
 
   for (u16 i = 0; i < cds; ++i) {
-    fwrite(&compress_dictionary[i].length, sizeof(u16), 1, output);
-    fwrite(compress_dictionary[i].data, sizeof(u8), compress_dictionary[i].length & 0x7FFF, output);
+    buffer_write(output, &state->compress_dictionary[i].length, sizeof(u16));
+    buffer_write(output, state->compress_dictionary[i].data, state->compress_dictionary[i].length & 0x7FFF);
   }
 }
 
-void write_compress_data(FILE *input, FILE *output, const u16 *new_dictionary_indexes)
+// the bytes every token takes in the output are counted in 'tokens'
+void write_compress_data(const compress_state *state, const byte_buffer *input, byte_buffer *output,
+                         const u16 *new_dictionary_indexes, bczip_token_stats *tokens)
 {
-  rewind(input);
-
-  i16 ch;
-  while ((ch = getc(input)) != EOF) {
-    putc(ch, output);
+  u32 offset = 0;
+  while (offset < input->size) {
+    const u32 output_size = output->size;
+    const u8 ch = input->data[offset++];
+    u8 token = ch & 0x0F;
+    buffer_put(output, ch);
     u32 to_copy = 0;
 
     switch (ch & 0x0F) {
@@ -887,31 +1560,47 @@ void write_compress_data(FILE *input, FILE *output, const u16 *new_dictionary_in
     }
 
     case FN_SKIP_LONG: {
-      const u8 ch2 = getc(input);
+      const u8 ch2 = buffer_get(input, offset++);
       to_copy = (ch >> 4) + (ch2 << 4) + 1;
-      putc(ch2, output);
+      buffer_put(output, ch2);
       break;
     }
 
     case FN_DICTIONARY: {
-      fseek(output, -1, SEEK_CUR);
-      const u16 i = new_dictionary_indexes[(ch >> 4) + (getc(input) << 4)];
+      output->size--;
+      const u16 index = (ch >> 4) + ((u8)buffer_get(input, offset++) << 4);
+
+      if (index == BACK_REFERENCE_INDEX) {
+        token = BCZIP_TOKENS_COUNT - 1;
+        buffer_write(output, &BACK_REFERENCE_INDEX_AND_FN, sizeof(u16));
+
+        // length and distance varints are copied as they are
+        for (u8 varints = 2; varints; offset++) {
+          const u8 ch2 = buffer_get(input, offset);
+          buffer_put(output, ch2);
+          if (!(ch2 & 0x80)) { varints--; }
+        }
+        break;
+      }
 
-      if (compress_dictionary[i].usage_count == 1) {
-        fwrite(compress_dictionary[i].data, sizeof(u8), compress_dictionary[i].length & 0x7FFF, output);
+      // the items of a shared dictionary keep their indexes
+      const u16 i = state->shared_dictionary ? index : new_dictionary_indexes[index];
+
+      if (!state->shared_dictionary && state->compress_dictionary[i].usage_count == 1) {
+        buffer_write(output, state->compress_dictionary[i].data, state->compress_dictionary[i].length & 0x7FFF);
         break;
       }
 
       const u16 new_index_and_fn = (i << 4) + FN_DICTIONARY;
-      fwrite(&new_index_and_fn, sizeof(u16), 1, output);
+      buffer_write(output, &new_index_and_fn, sizeof(u16));
       break;
     }
 
     case FN_OFFSET_SEGMENT:
     case FN_JUMPING_SEGMENT: {
-      const u8 ch2 = getc(input);
+      const u8 ch2 = buffer_get(input, offset++);
       to_copy = ch2 + 1;
-      putc(ch2, output);
+      buffer_put(output, ch2);
       break;
     }
 
@@ -923,28 +1612,487 @@ void write_compress_data(FILE *input, FILE *output, const u16 *new_dictionary_in
     }
 
     while (to_copy--) {
-      putc(getc(input), output);
+      buffer_put(output, buffer_get(input, offset++));
+    }
+
+    tokens[token].emitted_bytes += output->size - output_size;
+  }
+}
+
+// Everything after the header, the dictionary and the tokens, is replaced with its Huffman
+// coded bytes when that's worth it: ... 8[window_log | ENTROPY_CODED] ... 32[size] 32[coded size] 8[coded..]
+void entropy_code_stream(compress_state *state, byte_buffer *output, byte_buffer *coded)
+{
+  const u32 header_size = state->shared_dictionary ? 8 : 4;
+  const u32 size = output->size - header_size;
+
+  const u32 saving = 2 * sizeof(u32) + size / EC_SAVING_RATIO;
+  if (size <= saving) { return; }
+
+  coded->size = 0;
+  buffer_reserve(coded, size - saving + sizeof(u64));
+  coded->size = huffman_encode(output->data + header_size, size, coded->data, size - saving);
+  if (!coded->size) { return; }
+
+  output->data[3] |= ENTROPY_CODED;
+  output->size = header_size;
+  buffer_write(output, &size, sizeof(u32));
+  buffer_write(output, &coded->size, sizeof(u32));
+  buffer_write(output, coded->data, coded->size);
+}
+
+// Splits tokens as write_compress_data writes them into the first byte of every token, the
+// bytes of the parameters that follow it, and the bytes it skips or the halves of a segment;
+// no section takes more than the tokens.
+void split_tokens(const u8 *data, u32 size, byte_buffer *sections)
+{
+  for (u8 i = 0; i < TOKEN_SECTIONS_COUNT; ++i) {
+    sections[i].size = 0;
+    buffer_reserve(&sections[i], size);
+  }
+
+  u32 offset = 0;
+  while (offset < size) {
+    const u8 ch = data[offset++];
+    buffer_put(&sections[TS_OPCODES], ch);
+    u32 parameters = 0;
+    u32 literals = 0;
+
+    switch (ch & 0x0F) {
+    case FN_SKIP: {
+      literals = (ch >> 4) + 1;
+      break;
+    }
+
+    case FN_SKIP_LONG: {
+      parameters = 1;
+      literals = (ch >> 4) + (data[offset] << 4) + 1;
+      break;
+    }
+
+    case FN_DICTIONARY: {
+      parameters = 1;
+      if ((ch >> 4) + (data[offset] << 4) != BACK_REFERENCE_INDEX) { break; }
+
+      // the length and distance varints
+      for (u8 varints = 2; varints; parameters++) {
+        if (!(data[offset + parameters] & 0x80)) { varints--; }
+      }
+      break;
+    }
+
+    case FN_OFFSET_SEGMENT:
+    case FN_JUMPING_SEGMENT: {
+      parameters = 1;
+      literals = data[offset] + 1;
+      break;
+    }
+
+    case FN_REPEAT_BYTE_LONG:
+    case FN_REPEAT_STRING_LONG:
+    case FN_ARITHMETIC_PROGRESSION:
+    case FN_GEOMETRIC_PROGRESSION:
+      parameters = 1;
     }
+
+    buffer_write(&sections[TS_PARAMETERS], data + offset, parameters);
+    buffer_write(&sections[TS_LITERALS], data + offset + parameters, literals);
+    offset += parameters + literals;
+  }
+}
+
+// 'size' bytes as they are, or Huffman coded when that saves 1/EC_SAVING_RATIO of them:
+// v[size] v[coded size, 0 when they're as they are] 8[bytes..]
+void write_section(byte_buffer *output, const u8 *data, u32 size, byte_buffer *coded)
+{
+  const u32 saving = 2 + size / EC_SAVING_RATIO;
+
+  coded->size = 0;
+  if (size > saving) {
+    buffer_reserve(coded, size - saving + sizeof(u64));
+    coded->size = huffman_encode(data, size, coded->data, size - saving);
+  }
+
+  u8 sizes[10];
+  u8 length = write_varint(sizes, size);
+  length += write_varint(sizes + length, coded->size);
+  buffer_write(output, sizes, length);
+
+  if (coded->size) {
+    buffer_write(output, coded->data, coded->size);
+  } else if (size) {
+    buffer_write(output, data, size);
   }
 }
 
-void compress(FILE *input, FILE *output)
+// The stream in four sections, each coded on its own: the dictionary, then the opcodes, the
+// parameters and the literals of the tokens, so that bytes alike are coded together:
+// ... 8[window_log | SPLIT_SECTIONS] ... { v[size] v[coded size] 8[bytes..] }..4
+void split_stream(compress_block *block, const byte_buffer *output, u32 tokens_start)
 {
-  create_compress_dictionary(input);
-  FILE *const tmp = tmpfile();
+  const u32 header_size = block->state.shared_dictionary ? 8 : 4;
+
+  split_tokens(output->data + tokens_start, output->size - tokens_start, block->sections);
+
+  byte_buffer *const split = &block->split_output;
+  split->size = 0;
+  buffer_write(split, output->data, header_size);
+  split->data[3] |= SPLIT_SECTIONS;
+
+  write_section(split, output->data + header_size, tokens_start - header_size, &block->entropy_coded);
+  for (u8 i = 0; i < TOKEN_SECTIONS_COUNT; ++i) {
+    write_section(split, block->sections[i].data, block->sections[i].size, &block->entropy_coded);
+  }
+}
+
+// A stream is kept as it is, entropy coded whole or split in sections, whichever is smallest:
+// sections pay off on all but the smallest streams, which can't afford a code table each.
+void code_stream(compress_block *block, byte_buffer *output, u32 tokens_start)
+{
+  compress_state *const state = &block->state;
+  const double start = seconds();
+  const u32 header_size = state->shared_dictionary ? 8 : 4;
+  const u32 size = output->size;
+
+  split_stream(block, output, tokens_start);
+  entropy_code_stream(state, output, &block->entropy_coded);
+
+  if (block->split_output.size < output->size) {
+    const byte_buffer split = block->split_output;
+    block->split_output = *output;
+    *output = split;
+  }
+
+  state->stats.entropy_seconds += seconds() - start;
+  if (output->size == size) { return; }
+
+  state->stats.entropy_input_bytes += size - header_size;
+  state->stats.entropy_output_bytes += output->size - header_size;
+}
+
+void compress_block_level(compress_block *block, const compress_level *level, byte_buffer *output)
+{
+  compress_state *const state = &block->state;
+
+  state->level = level;
+  block->tokens.size = 0;
+  output->size = 0;
+
+  bczip_compress_stats *const stats = &state->stats;
+  double start = seconds();
+
+  // a shared dictionary takes the place of the one the level would create, for every level
+  const compress_state *const shared = block->shared_dictionary;
+  if (shared->compress_dictionary_size) {
+    state->compress_dictionary = shared->compress_dictionary;
+    state->compress_dictionary_size = shared->compress_dictionary_size;
+    state->compress_dictionary_index = shared->compress_dictionary_index;
+    state->compress_dictionary_index_heads = shared->compress_dictionary_index_heads;
+    state->compress_dictionary_index_bits = shared->compress_dictionary_index_bits;
+    state->shared_dictionary = true;
+    state->dictionary_id = shared->dictionary_id;
+
+    parse_block(block, stats->tokens);
+    stats->parse_seconds += seconds() - start;
+
+    start = seconds();
+    write_compress_dictionary(state, output);
+    const u32 tokens_start = output->size;
+    write_compress_data(state, &block->tokens, output, NULL, stats->tokens);
+    stats->write_seconds += seconds() - start;
+    code_stream(block, output, tokens_start);
+
+    state->compress_dictionary = NULL;
+    state->compress_dictionary_size = 0;
+    state->compress_dictionary_index = NULL;
+    state->compress_dictionary_index_heads = NULL;
+    state->shared_dictionary = false;
+    return;
+  }
 
-  perform_compression(input, tmp);
+  if (level->dictionary) {
+    create_compress_dictionary(state, &block->input);
+
+    stats->dictionary_items_count += state->compress_dictionary_size;
+    for (u16 i = 0; i < state->compress_dictionary_size; ++i) {
+      stats->dictionary_bytes += state->compress_dictionary[i].length;
+    }
+
+    stats->dictionary_seconds += seconds() - start;
+    start = seconds();
+  }
+
+  parse_block(block, stats->tokens);
+  stats->parse_seconds += seconds() - start;
 
   {
-    u16 *const new_dictionary_indexes = malloc(compress_dictionary_size * sizeof(u16));
+    u16 *const new_dictionary_indexes = malloc(state->compress_dictionary_size * sizeof(u16));
+
+    start = seconds();
+    optimize_compress_dictionary(state, new_dictionary_indexes, block->pool, block->settings->threads_count);
+    stats->optimize_seconds += seconds() - start;
+
+    // the items used more than once come first, they're the ones written
+    for (u16 i = 0; i < state->compress_dictionary_size && state->compress_dictionary[i].usage_count > 1; ++i) {
+      stats->written_dictionary_items_count++;
+      stats->written_dictionary_bytes += state->compress_dictionary[i].length & 0x7FFF;
+    }
 
-    optimize_compress_dictionary(new_dictionary_indexes);
-    write_compress_dictionary(output);
-    write_compress_data(tmp, output, new_dictionary_indexes);
+    start = seconds();
+    write_compress_dictionary(state, output);
+    const u32 tokens_start = output->size;
+    write_compress_data(state, &block->tokens, output, new_dictionary_indexes, stats->tokens);
+    stats->write_seconds += seconds() - start;
+    code_stream(block, output, tokens_start);
 
     free(new_dictionary_indexes);
   }
 
-  fclose(tmp);
-  delete_compress_dictionary();
+  delete_compress_dictionary(state);
+}
+
+void compress_block_task(void *block_pointer)
+{
+  compress_block *const block = block_pointer;
+  const compress_level *const level = COMPRESS_LEVELS + (block->settings->level ? block->settings->level : BCZIP_LEVEL_DEFAULT);
+
+  block->state.window_log = block->settings->window_log;
+  block->state.stats = (bczip_compress_stats){0};
+  price_bytes(&block->state, NULL);
+  compress_block_level(block, level, &block->output);
+
+  if (!level->alternative) { return; }
+
+  // the stats of the output kept, with the work of the other one
+  bczip_compress_stats stats = block->state.stats;
+  block->state.stats = (bczip_compress_stats){0};
+
+  compress_block_level(block, level->alternative, &block->alternative_output);
+  if (block->alternative_output.size < block->output.size) {
+    const byte_buffer output = block->output;
+    block->output = block->alternative_output;
+    block->alternative_output = output;
+
+    add_compress_stats(&block->state.stats, &stats, false);
+    return;
+  }
+
+  add_compress_stats(&stats, &block->state.stats, false);
+  block->state.stats = stats;
+}
+
+double seconds(void)
+{
+  struct timespec time;
+  clock_gettime(CLOCK_MONOTONIC, &time);
+  return time.tv_sec + time.tv_nsec / 1e9;
+}
+
+// the work counted in 'other' is added to 'stats', the tokens and the dictionary only when
+// 'output' is set, since they describe an output
+void add_compress_stats(bczip_compress_stats *stats, const bczip_compress_stats *other, bool output)
+{
+  stats->segments_count += other->segments_count;
+  for (u32 i = 0; i < BCZIP_CHECKS_COUNT; ++i) {
+    stats->check_segments_count[i] += other->check_segments_count[i];
+  }
+
+  for (u32 i = 0; i < BCZIP_TOKENS_COUNT; ++i) {
+    stats->tokens[i].checks_count += other->tokens[i].checks_count;
+    if (!output) { continue; }
+
+    stats->tokens[i].count += other->tokens[i].count;
+    stats->tokens[i].covered_bytes += other->tokens[i].covered_bytes;
+    stats->tokens[i].emitted_bytes += other->tokens[i].emitted_bytes;
+  }
+
+  stats->dictionary_seconds += other->dictionary_seconds;
+  stats->parse_seconds += other->parse_seconds;
+  stats->optimize_seconds += other->optimize_seconds;
+  stats->write_seconds += other->write_seconds;
+  stats->entropy_seconds += other->entropy_seconds;
+
+  if (!output) { return; }
+
+  stats->entropy_input_bytes += other->entropy_input_bytes;
+  stats->entropy_output_bytes += other->entropy_output_bytes;
+
+  stats->dictionary_items_count += other->dictionary_items_count;
+  stats->dictionary_bytes += other->dictionary_bytes;
+  stats->written_dictionary_items_count += other->written_dictionary_items_count;
+  stats->written_dictionary_bytes += other->written_dictionary_bytes;
+}
+
+void write_u32(FILE *output, u32 value)
+{
+  fwrite(&value, sizeof(u32), 1, output);
+}
+
+compressor *create_compressor(const bczip_compress_settings *settings, thread_pool *pool)
+{
+  compressor *const compressor = calloc(1, sizeof(struct compressor_t));
+  compressor->settings = *settings;
+  compressor->pool = pool;
+
+  compressor->blocks_capacity = settings->threads_count > 1 ? settings->threads_count * 2 : 1;
+  compressor->blocks = calloc(compressor->blocks_capacity, sizeof(compress_block));
+  for (u32 i = 0; i < compressor->blocks_capacity; ++i) {
+    compressor->blocks[i].settings = &compressor->settings;
+    compressor->blocks[i].shared_dictionary = &compressor->shared_dictionary;
+  }
+
+  return compressor;
+}
+
+void delete_compressor(compressor *compressor)
+{
+  for (u32 i = 0; i < compressor->blocks_capacity; ++i) {
+    free(compressor->blocks[i].input.data);
+    free(compressor->blocks[i].tokens.data);
+    free(compressor->blocks[i].alternative_tokens.data);
+    free(compressor->blocks[i].output.data);
+    free(compressor->blocks[i].alternative_output.data);
+    free(compressor->blocks[i].entropy_coded.data);
+    free(compressor->blocks[i].sections[TS_OPCODES].data);
+    free(compressor->blocks[i].sections[TS_PARAMETERS].data);
+    free(compressor->blocks[i].sections[TS_LITERALS].data);
+    free(compressor->blocks[i].split_output.data);
+    free(compressor->blocks[i].state.options);
+    free(compressor->blocks[i].state.pass_options);
+    free(compressor->blocks[i].state.parse_nodes);
+  }
+
+  set_compressor_dictionary(compressor, NULL);
+  free(compressor->blocks);
+  free(compressor);
+}
+
+void get_compress_stats(const compressor *compressor, bczip_compress_stats *stats)
+{
+  *stats = compressor->stats;
+}
+
+// the items point into the dictionary, which must outlive its use; NULL removes the dictionary
+void set_compressor_dictionary(compressor *compressor, const bczip_dictionary *dictionary)
+{
+  compress_state *const shared = &compressor->shared_dictionary;
+  delete_compress_dictionary_index(shared);
+  free(shared->compress_dictionary);
+  shared->compress_dictionary = NULL;
+  shared->compress_dictionary_size = 0;
+
+  if (!dictionary || !dictionary_items_count(dictionary)) { return; }
+
+  shared->dictionary_id = dictionary_id(dictionary);
+  shared->compress_dictionary_size = dictionary_items_count(dictionary);
+  shared->compress_dictionary = malloc(shared->compress_dictionary_size * sizeof(compress_dictionary_item));
+
+  for (u16 i = 0; i < shared->compress_dictionary_size; ++i) {
+    compress_dictionary_item *const item = shared->compress_dictionary + i;
+    item->data = (u8 *)dictionary_item(dictionary, i, &item->length);
+    item->usage_count = 0;
+    item->repeat_count = 0;
+    item->index = i;
+  }
+
+  create_compress_dictionary_index(shared);
+}
+
+const char *check_name(u32 check)
+{
+  return check < BCZIP_CHECKS_COUNT ? TOKEN_NAMES[check + 2] : NULL;
+}
+
+const char *token_name(u32 token)
+{
+  return token < BCZIP_TOKENS_COUNT ? TOKEN_NAMES[token] : NULL;
+}
+
+// An input that fits in one block is written as a single stream. A longer one is written as
+// blocks, each a complete stream of its own, framed by its uncompressed and compressed lengths:
+// 8[0xBC] 12[block_log] 4[0xB] { 32[uncompressed length] 32[compressed length] 8[stream..] }.. 32[0] 32[0]
+// and followed by an index footer repeating every frame's lengths, so that a reader can find
+// any block by seeking from the end of the file:
+// { 32[uncompressed length] 32[compressed length] }.. 32[blocks count] 32[INDEX_FOOTER_MAGIC]
+void compress(compressor *compressor, FILE *input, FILE *output)
+{
+  const bczip_compress_settings *const settings = &compressor->settings;
+  const u32 block_size = 1u << settings->block_log;
+  const u32 blocks_capacity = compressor->blocks_capacity;
+  compress_block *const blocks = compressor->blocks;
+
+  for (u32 i = 0; i < blocks_capacity; ++i) {
+    blocks[i].input.size = 0;
+  }
+
+  compressor->stats = (bczip_compress_stats){0};
+
+  rewind(input);
+  buffer_read_stream(&blocks[0].input, input, block_size);
+
+  i16 ch = getc(input);
+  if (ch == EOF) {
+    // the pool has nothing else to do while a single block is compressed
+    blocks[0].pool = compressor->pool;
+    compress_block_task(blocks);
+    blocks[0].pool = NULL;
+    add_compress_stats(&compressor->stats, &blocks[0].state.stats, true);
+    fwrite(blocks[0].output.data, sizeof(u8), blocks[0].output.size, output);
+  } else {
+    ungetc(ch, input);
+
+    putc(0xBC, output); // write first MAGIC_HEADER part
+    const u16 block_log_with_second_magic_header_part = (settings->block_log << 4) + 0xB;
+    fwrite(&block_log_with_second_magic_header_part, sizeof(u16), 1, output);
+
+    byte_buffer index = {0};
+    u32 index_blocks_count = 0;
+
+    // blocks are read and compressed in batches, then written in order
+    u32 blocks_count = 1;
+    do {
+      while (blocks_count < blocks_capacity) {
+        buffer_read_stream(&blocks[blocks_count].input, input, block_size);
+        if (!blocks[blocks_count].input.size) { break; }
+
+        blocks_count++;
+      }
+
+      for (u32 i = 0; i < blocks_count; ++i) {
+        thread_pool_submit(compressor->pool, compress_block_task, blocks + i);
+      }
+
+      thread_pool_wait(compressor->pool);
+
+      for (u32 i = 0; i < blocks_count; ++i) {
+        write_u32(output, blocks[i].input.size);
+        write_u32(output, blocks[i].output.size);
+        fwrite(blocks[i].output.data, sizeof(u8), blocks[i].output.size, output);
+
+        buffer_write(&index, &blocks[i].input.size, sizeof(u32));
+        buffer_write(&index, &blocks[i].output.size, sizeof(u32));
+        index_blocks_count++;
+
+        add_compress_stats(&compressor->stats, &blocks[i].state.stats, true);
+
+        blocks[i].input.size = 0;
+      }
+
+      // a pipe gets every batch as soon as it's ready
+      fflush(output);
+
+      buffer_read_stream(&blocks[0].input, input, block_size);
+      blocks_count = blocks[0].input.size ? 1 : 0;
+    } while (blocks_count);
+
+    write_u32(output, 0);
+    write_u32(output, 0);
+
+    fwrite(index.data, sizeof(u8), index.size, output);
+    write_u32(output, index_blocks_count);
+    write_u32(output, INDEX_FOOTER_MAGIC);
+    free(index.data);
+  }
+
+  fflush(output);
 }
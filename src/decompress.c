@@ -1,301 +1,1167 @@
+#include "bczip.h"
 #include "types.h"
+#include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+typedef struct thread_pool_t thread_pool;
+extern void thread_pool_submit(thread_pool *pool, void (*function)(void *), void *argument);
+extern void thread_pool_wait(thread_pool *pool);
+
+typedef struct bczip_dictionary_t bczip_dictionary;
+extern u32 dictionary_id(const bczip_dictionary *dictionary);
+extern u16 dictionary_items_count(const bczip_dictionary *dictionary);
+extern const u8 *dictionary_item(const bczip_dictionary *dictionary, u16 i, u16 *length);
+
+extern bool huffman_decode(const u8 *input, u32 input_size, u8 *output, u32 output_size);
+
+enum function_number {
+  FN_SKIP,
+  FN_SKIP_LONG,
+  FN_REPEAT_BYTE,
+  FN_REPEAT_BYTE_LONG,
+  FN_REPEAT_STRING,
+  FN_REPEAT_STRING_LONG,
+  FN_MIRROR_STRING,
+  FN_DICTIONARY,
+  FN_ONE_PARTICULAR_BYTE,
+  FN_ARITHMETIC_PROGRESSION,
+  FN_GEOMETRIC_PROGRESSION,
+  FN_FIBONACCI_PROGRESSION,
+  FN_SHIFT_LEFT,
+  FN_SHIFT_RIGHT,
+  FN_OFFSET_SEGMENT,
+  FN_JUMPING_SEGMENT,
+};
+
+// Tokens are read from three cursors in memory, which move through the same bytes unless the
+// stream is split in sections: the opcode of every token, whose high nibble is its first
+// parameter, the bytes of the rest of its parameters, and the bytes it skips or the halves of
+// a segment.
+typedef struct token_input_t {
+  const u8 *opcodes;
+  const u8 *opcodes_end;
+  const u8 *parameters;
+  const u8 *parameters_end;
+  const u8 *literals;
+  const u8 *literals_end;
+  bool split;
+} token_input;
 
 typedef struct decompress_dictionary_item_t {
   u8 *data;
   u16 length;
 } decompress_dictionary_item;
 
+// the dictionary streams of version 0xC are decoded with, whose items point into its file
+typedef struct shared_dictionary_t {
+  u32 id;
+  decompress_dictionary_item *items;
+  u16 items_count;
+} shared_dictionary;
+
+// Decoded bytes are collected in 'data', which also serves as the history that tokens copy
+// from. With a file, everything before the last 'history_limit' bytes is written out once
+// 'data' is full, so the file is only ever written forward; without one, 'data' simply grows,
+// up to 'limit' bytes beyond which only a corrupted stream goes. The dictionary is the one of
+// the stream being decoded. Tokens are counted in 'stats', unless it's NULL.
+typedef struct decompress_output_t {
+  u8 *data;
+  u32 size;
+  u32 capacity;
+  u32 history_limit;
+  u32 limit;
+  u32 written;
+  u64 dropped; // written out and no longer in 'data'
+  FILE *file;
+
+  decompress_dictionary_item *dictionary;
+  u16 dictionary_size;
+
+  bczip_decompress_stats *stats;
+
+  const shared_dictionary *shared_dictionary;
+} decompress_output;
+
+typedef struct decompress_block_t {
+  u8 *input;
+  i64 input_offset;
+  u32 input_length;
+  u32 output_length;
+  i64 output_offset;
+  i32 output_fd;
+  bczip_decompress_stats stats;
+  const shared_dictionary *shared_dictionary;
+  bool decompressed; // by its task, false when it's corrupted
+} decompress_block;
+
+// a decompressor keeps its output history and frame buffer from one call to the next, the
+// thread pool belongs to whoever created the decompressor
+typedef struct decompressor_t {
+  u32 threads_count;
+  thread_pool *pool;
+  decompress_output output;
+  u8 *frame;
+  u32 frame_capacity;
+  shared_dictionary shared_dictionary; // without items when there's none
+  bczip_decompress_stats stats;
+} decompressor;
+
 // ================================================================================ external functions
 
-void decompress(FILE *input, FILE *output);
+decompressor *create_decompressor(u32 threads_count, thread_pool *pool);
+bool decompress(decompressor *decompressor, FILE *input, FILE *output);
+bool decompress_range(decompressor *decompressor, FILE *input, FILE *output, u64 start, u64 length);
+void delete_decompressor(decompressor *decompressor);
+void get_decompress_stats(const decompressor *decompressor, bczip_decompress_stats *stats);
+void set_decompressor_dictionary(decompressor *decompressor, const bczip_dictionary *dictionary);
+u32 input_dictionary_id(FILE *input);
 
 // ================================================================================ internal functions
 
-static void skip(FILE *input, FILE *output);                   // 0x0 | - 4[FN]  4[count] 8[bytes..]
-static void skip_long(FILE *input, FILE *output);              // 0x1 | - 4[FN] 12[count] 8[bytes..]
-static void repeat_byte(FILE *input, FILE *output);            // 0x2 | + 4[FN]  4[count]
-static void repeat_byte_long(FILE *input, FILE *output);       // 0x3 | + 4[FN] 12[count]
-static void repeat_string(FILE *input, FILE *output);          // 0x4 | + 4[FN] 4[length]
-static void repeat_string_long(FILE *input, FILE *output);     // 0x5 | + 4[FN] 4[length] 8[count]
-static void mirror_string(FILE *input, FILE *output);          // 0x6 | + 4[FN] 4[length]
-static void dictionary(FILE *input, FILE *output);             // 0x7 | - 4[FN] 12[index]
-static void one_particular_byte(FILE *input, FILE *output);    // 0x8 | - 4[FN] 4[offset]
-static void arithmetic_progression(FILE *input, FILE *output); // 0x9 | + 4[FN] 4[count] 8[factor]
-static void geometric_progression(FILE *input, FILE *output);  // 0xA | + 4[FN] 4[count] 8[factor]
-static void fibonacci_progression(FILE *input, FILE *output);  // 0xB | + 4[FN] 4[count]
-static void shift_left(FILE *input, FILE *output);             // 0xC | + 4[FN] 4[count]
-static void shift_right(FILE *input, FILE *output);            // 0xD | + 4[FN] 4[count]
-static void offset_segment(FILE *input, FILE *output);         // 0xE | - 4[FN] 4[offset] 8[count] 4[halves..]
-static void jumping_segment(FILE *input, FILE *output);        // 0xF | - 4[FN] 4[offset] 8[count] 4[halves..]
-
-static void create_decompress_dictionary(FILE *input);
-static void delete_decompress_dictionary(void);
+static void create_decompress_output(decompress_output *output, FILE *file, u32 history_limit);
+static void create_block_output(decompress_output *output, u32 length);
+static void output_reserve(decompress_output *output, u32 size);
+static void output_flush(decompress_output *output);
+static void copy_back(u8 *output, u32 distance, u32 length);
+
+static u8 read_byte(const u8 **input, const u8 *end);
+static u32 read_varint(const u8 **input, const u8 *end);
+static u32 read_u32(FILE *input);
+
+static u32 create_decompress_dictionary(const u8 *input, u32 size, decompress_output *output, u16 header);
+static void delete_decompress_dictionary(decompress_output *output);
+
+static double seconds(void);
+static void add_decompress_stats(bczip_decompress_stats *stats, const bczip_decompress_stats *other);
+
+static bool decompress_tokens(token_input *input, decompress_output *output);
+static u8 *decode_entropy_coded(const u8 *input, u32 input_size, u32 *size);
+static bool read_section(const u8 **input, const u8 *end, const u8 **section, u32 *size, u8 **decoded);
+static bool decompress_stream(const u8 *input, u32 size, decompress_output *output);
+static u32 read_single_stream(decompressor *decompressor, FILE *input, u16 header);
+static u32 read_dictionary_id(FILE *input);
+static u8 *decompress_block_data(decompress_block *block);
+static bool read_block_index(FILE *input, decompress_block **blocks, u32 *blocks_size);
+static void decompress_block_task(void *block);
+static bool decompress_blocks(decompressor *decompressor, FILE *input, FILE *output);
 
 // ================================================================================ internal variables
 
-static decompress_dictionary_item *decompress_dictionary;
-static u16 decompress_dictionary_size;
-
-static void (*const DECOMPRESS_FUNCTIONS[])(FILE *, FILE *) = {
-  skip,
-  skip_long,
-  repeat_byte,
-  repeat_byte_long,
-  repeat_string,
-  repeat_string_long,
-  mirror_string,
-  dictionary,
-  one_particular_byte,
-  arithmetic_progression,
-  geometric_progression,
-  fibonacci_progression,
-  shift_left,
-  shift_right,
-  offset_segment,
-  jumping_segment,
-};
+static const u16 BACK_REFERENCE_INDEX = 0xFFF;
+static const u32 BR_LENGTH_LIMIT = 6;
+static const u32 BR_LENGTH_MAX = 0xFFFF;
+
+static const u16 DD_ITEM_LENGTH_MAX = 0x7FFF;
+
+static const u32 INDEX_FOOTER_MAGIC = 0x58494342; // "BCIX"
+
+static const u8 ENTROPY_CODED = 0x80;
+static const u8 SPLIT_SECTIONS = 0x40;
+static const u32 EC_SIZE_LIMIT = 0x80000000;
+
+// the dictionary, then the opcodes, parameters and literals of the tokens
+#define SPLIT_SECTIONS_COUNT 4
+
+// streams written before the window was stored only look a few bytes back
+static const u32 DO_HISTORY_LIMIT_V1 = 0x100;
+static const u32 DO_CAPACITY_MIN = 0x10000;
+
+// room for the longest token, a back-reference, and for the words copies write past their end
+static const u32 DO_TOKEN_ROOM = 0x10000 + 16;
+
+// no stream decodes to more than a block, a corrupted one stops there
+static const u32 DO_SIZE_LIMIT = 1u << BCZIP_BLOCK_LOG_MAX;
 
 // ================================================================================ definitions
 
-void skip(FILE *input, FILE *output)
+void create_decompress_output(decompress_output *output, FILE *file, u32 history_limit)
+{
+  *output = (decompress_output){NULL, 0, 0, history_limit, DO_SIZE_LIMIT, 0, 0, file, NULL, 0, NULL, NULL};
+}
+
+// a block decodes into memory made for its length up front, and no further even when it's
+// corrupted; a single stream doesn't store its length, 0, and grows as it's decoded
+void create_block_output(decompress_output *output, u32 length)
 {
-  for (i8 i = getc(input) >> 4; i >= 0; --i) {
-    putc(getc(input), output);
+  create_decompress_output(output, NULL, 0);
+  if (length < DO_SIZE_LIMIT) {
+    output->limit = length ? length : DO_SIZE_LIMIT;
+    output_reserve(output, length + DO_TOKEN_ROOM);
   }
 }
 
-void skip_long(FILE *input, FILE *output)
+// makes room for 'size' more bytes, writing out and dropping what's older than the history
+void output_reserve(decompress_output *output, u32 size)
 {
-  i32 i;
-  fread(&i, sizeof(u16), 1, input);
-  i >>= 4;
+  if (output->size + size <= output->capacity) { return; }
+
+  if (output->file) {
+    output_flush(output);
+
+    const u32 kept = output->size < output->history_limit ? output->size : output->history_limit;
+    if (kept) { memmove(output->data, output->data + output->size - kept, kept); }
+    output->dropped += output->size - kept;
+    output->size = kept;
+    output->written = kept;
+
+    if (output->size + size <= output->capacity) { return; }
+  }
 
-  while (i-- >= 0) {
-    putc(getc(input), output);
+  while (output->size + size > output->capacity) {
+    output->capacity = output->capacity ? output->capacity * 2 : DO_CAPACITY_MIN;
   }
+
+  output->data = realloc(output->data, output->capacity * sizeof(u8));
 }
 
-void repeat_byte(FILE *input, FILE *output)
+void output_flush(decompress_output *output)
 {
-  fseek(output, -1, SEEK_CUR);
-  const u8 ch = getc(output);
+  if (!output->file || output->written == output->size) { return; }
 
-  for (i8 i = getc(input) >> 4; i >= 0; --i) {
-    putc(ch, output);
-  }
+  fwrite(output->data + output->written, sizeof(u8), output->size - output->written, output->file);
+  output->written = output->size;
 }
 
-void repeat_byte_long(FILE *input, FILE *output)
+// Copies 'length' bytes from 'distance' bytes back. A source overlapping the copy repeats
+// itself, so it's copied a period at a time, the period doubling with every copy; any other is
+// copied 16 bytes at a time, which writes up to 15 bytes past the end.
+void copy_back(u8 *output, u32 distance, u32 length)
 {
-  fseek(output, -1, SEEK_CUR);
-  const u8 ch = getc(output);
+  const u8 *const source = output - distance;
 
-  i32 i;
-  fread(&i, sizeof(u16), 1, input);
-  i >>= 4;
+  if (distance >= 16) {
+    for (u32 i = 0; i < length; i += 16) {
+      memcpy(output + i, source + i, 16);
+    }
+    return;
+  }
 
-  while (i-- >= 0) {
-    putc(ch, output);
+  while (distance < length) {
+    memcpy(output, source, distance);
+    output += distance;
+    length -= distance;
+    distance *= 2;
   }
+
+  memcpy(output, source, length);
+}
+
+// the next byte of a section, zero past its end in a corrupted stream
+u8 read_byte(const u8 **input, const u8 *end)
+{
+  return *input < end ? *(*input)++ : 0;
 }
 
-void repeat_string(FILE *input, FILE *output)
+// no more than the 5 bytes of a u32, whatever a corrupted stream has
+u32 read_varint(const u8 **input, const u8 *end)
 {
-  const u8 length = (getc(input) >> 4) + 2;
-  u8 *const str = alloca(length * sizeof(u8));
+  u32 value = 0;
+  for (u8 shift = 0; shift < 35 && *input < end; shift += 7) {
+    const u8 ch = *(*input)++;
 
-  fseek(output, -length, SEEK_CUR);
-  fread(str, sizeof(u8), length, output);
+    value |= (u32)(ch & 0x7F) << shift;
+    if (!(ch & 0x80)) { break; }
+  }
+
+  return value;
+}
 
-  fwrite(str, sizeof(u8), length, output);
+u32 read_u32(FILE *input)
+{
+  u32 value = 0;
+  fread(&value, sizeof(u32), 1, input);
+  return value;
 }
 
-void repeat_string_long(FILE *input, FILE *output)
+// The stream header has already been read; compressed items are decoded one after another in
+// the same output, each with a history of its own, then copied out of it. Returns how many
+// bytes of 'input' the dictionary took.
+u32 create_decompress_dictionary(const u8 *input, u32 size, decompress_output *output, u16 header)
 {
-  const u8 length = (getc(input) >> 4) + 2;
-  u8 *const str = alloca(length * sizeof(u8));
+  output->dictionary_size = header >> 4;
+  output->dictionary = calloc(output->dictionary_size, sizeof(decompress_dictionary_item));
+
+  decompress_output item_output;
+  create_decompress_output(&item_output, NULL, 0);
+  item_output.limit = DD_ITEM_LENGTH_MAX;
+  item_output.dictionary = output->dictionary;
+  item_output.dictionary_size = output->dictionary_size;
+
+  const u8 *const start = input;
+  const u8 *const end = input + size;
+
+  for (u16 i = 0; i < output->dictionary_size && end - input >= sizeof(u16); ++i) {
+    u16 length;
+    memcpy(&length, input, sizeof(u16));
+    input += sizeof(u16);
+
+    const bool compressed = length & 0x8000;
+    length &= 0x7FFF;
+    if (length > end - input) { length = end - input; }
 
-  fseek(output, -length, SEEK_CUR);
-  fread(str, sizeof(u8), length, output);
+    decompress_dictionary_item *const item = output->dictionary + i;
+    const u8 *data = input;
 
-  for (u16 i = getc(input) + 2; i; --i) {
-    fwrite(str, sizeof(u8), length, output);
+    if (compressed) {
+      item_output.size = 0;
+      token_input item_tokens = {input, input + length, input, input + length, input, input + length, false};
+      decompress_tokens(&item_tokens, &item_output);
+
+      data = item_output.data;
+      input += length;
+      length = item_output.size < DD_ITEM_LENGTH_MAX ? item_output.size : DD_ITEM_LENGTH_MAX;
+    } else {
+      input += length;
+    }
+
+    item->data = malloc(length * sizeof(u8));
+    item->length = length;
+    memcpy(item->data, data, length);
   }
+
+  free(item_output.data);
+  return input - start;
 }
 
-void mirror_string(FILE *input, FILE *output)
+void delete_decompress_dictionary(decompress_output *output)
 {
-  u8 length = (getc(input) >> 4) + 2;
-  u8 *const str = alloca(length * sizeof(u8));
+  while (output->dictionary_size) {
+    free(output->dictionary[--output->dictionary_size].data);
+  }
+
+  free(output->dictionary);
+  output->dictionary = NULL;
+}
 
-  fseek(output, -length, SEEK_CUR);
-  fread(str, sizeof(u8), length, output);
+double seconds(void)
+{
+  struct timespec time;
+  clock_gettime(CLOCK_MONOTONIC, &time);
+  return time.tv_sec + time.tv_nsec / 1e9;
+}
 
-  while (length) {
-    putc(str[--length], output);
+void add_decompress_stats(bczip_decompress_stats *stats, const bczip_decompress_stats *other)
+{
+  for (u32 i = 0; i < BCZIP_TOKENS_COUNT; ++i) {
+    stats->tokens[i].count += other->tokens[i].count;
+    stats->tokens[i].covered_bytes += other->tokens[i].covered_bytes;
   }
+
+  stats->entropy_seconds += other->entropy_seconds;
+  stats->dictionary_seconds += other->dictionary_seconds;
+  stats->tokens_seconds += other->tokens_seconds;
 }
 
-void dictionary(FILE *input, FILE *output)
+// Tokens run to the end of their opcodes, each one written straight into the output, which
+// first gets room for the most any token writes so that no copy checks it on its own; copies
+// may write up to 15 bytes past their end to move whole words. A corrupted token, which reads
+// past the end of its literals or before the start of the output, or writes past the limit of
+// the output, ends the opcodes there, and false is returned.
+bool decompress_tokens(token_input *input, decompress_output *output)
 {
-  u16 i;
-  fread(&i, sizeof(u16), 1, input);
-  i >>= 4;
+  const u8 *o = input->opcodes;
+  const u8 *o_end = input->opcodes_end;
+  const u8 *p = input->parameters;
+  const u8 *const p_end = input->parameters_end;
+  const u8 *l = input->literals;
+  const u8 *const l_end = input->literals_end;
+  const bool split = input->split;
+
+  output_reserve(output, DO_TOKEN_ROOM);
+  u8 *out = output->data + output->size;
+  u8 *out_end = output->data + output->capacity;
+
+  while (o < o_end) {
+    if (out_end - out < DO_TOKEN_ROOM) {
+      output->size = out - output->data;
+      if (output->size >= output->limit) {
+        o_end = o;
+        break;
+      }
+
+      output_reserve(output, DO_TOKEN_ROOM);
+      out = output->data + output->size;
+      out_end = output->data + output->capacity;
+    }
+
+    const u8 ch = *o++;
+    u8 *const token_start = out;
+    u8 token = ch & 0x0F;
+
+    // the parameters of a token that isn't split follow its opcode, then its literals
+    if (!split) { p = o; }
+
+    switch (ch & 0x0F) {
+    case FN_SKIP: {
+      const u32 count = (ch >> 4) + 1;
+      if (!split) { l = p; }
+
+      if (l_end - l >= 16) {
+        memcpy(out, l, 16);
+      } else if (count <= l_end - l) {
+        memcpy(out, l, count);
+      } else {
+        o_end = o;
+        break;
+      }
+
+      out += count;
+      l += count;
+      break;
+    }
+
+    case FN_SKIP_LONG: {
+      const u32 count = (ch >> 4) + (read_byte(&p, p_end) << 4) + 1;
+      if (!split) { l = p; }
+
+      if (count > l_end - l) {
+        o_end = o;
+        break;
+      }
+
+      memcpy(out, l, count);
+      out += count;
+      l += count;
+      break;
+    }
+
+    case FN_REPEAT_BYTE: {
+      if (out == output->data) {
+        o_end = o;
+        break;
+      }
+
+      memset(out, out[-1], 16);
+      out += (ch >> 4) + 1;
+      break;
+    }
+
+    case FN_REPEAT_BYTE_LONG: {
+      const u32 count = (ch >> 4) + (read_byte(&p, p_end) << 4) + 1;
+      if (out == output->data) {
+        o_end = o;
+        break;
+      }
+
+      memset(out, out[-1], count);
+      out += count;
+      break;
+    }
+
+    case FN_REPEAT_STRING: {
+      const u32 length = (ch >> 4) + 2;
+      if (length > out - output->data) {
+        o_end = o;
+        break;
+      }
+
+      memcpy(out, out - length, length);
+      out += length;
+      break;
+    }
+
+    case FN_REPEAT_STRING_LONG: {
+      const u32 length = (ch >> 4) + 2;
+      const u32 count = read_byte(&p, p_end) + 2;
+      if (length > out - output->data) {
+        o_end = o;
+        break;
+      }
+
+      copy_back(out, length, length * count);
+      out += length * count;
+      break;
+    }
+
+    case FN_MIRROR_STRING: {
+      const u32 length = (ch >> 4) + 2;
+      if (length > out - output->data) {
+        o_end = o;
+        break;
+      }
+
+      for (u32 i = 0; i < length; ++i) {
+        out[i] = *(out - 1 - i);
+      }
+
+      out += length;
+      break;
+    }
+
+    case FN_DICTIONARY: {
+      const u32 index = (ch >> 4) + (read_byte(&p, p_end) << 4);
+
+      if (index == BACK_REFERENCE_INDEX) {
+        token = BCZIP_TOKENS_COUNT - 1;
+        const u32 length = read_varint(&p, p_end);
+        const u32 distance = read_varint(&p, p_end);
+        if (length > BR_LENGTH_MAX - BR_LENGTH_LIMIT || distance >= out - output->data) {
+          o_end = o;
+          break;
+        }
+
+        copy_back(out, distance + 1, length + BR_LENGTH_LIMIT);
+        out += length + BR_LENGTH_LIMIT;
+        break;
+      }
+
+      if (index >= output->dictionary_size) {
+        o_end = o;
+        break;
+      }
+
+      const decompress_dictionary_item *const item = output->dictionary + index;
+      if (item->length) { memcpy(out, item->data, item->length); }
+      out += item->length;
+      break;
+    }
+
+    case FN_ONE_PARTICULAR_BYTE: {
+      *out++ = (ch >> 4) * 0x11;
+      break;
+    }
+
+    case FN_ARITHMETIC_PROGRESSION:
+    case FN_GEOMETRIC_PROGRESSION: {
+      const u8 factor = read_byte(&p, p_end);
+      if (out == output->data) {
+        o_end = o;
+        break;
+      }
+
+      u8 value = out[-1];
+      for (u32 i = (ch >> 4) + 1; i; --i) {
+        value = (ch & 0x0F) == FN_ARITHMETIC_PROGRESSION ? value + factor : value * factor;
+        *out++ = value;
+      }
+      break;
+    }
+
+    case FN_FIBONACCI_PROGRESSION: {
+      if (out - output->data < 2) {
+        o_end = o;
+        break;
+      }
+
+      u8 first = out[-2];
+      u8 second = out[-1];
+      for (u32 i = (ch >> 4) + 1; i; --i) {
+        const u8 next = first + second;
+        first = second;
+        second = next;
+        *out++ = next;
+      }
+      break;
+    }
+
+    case FN_SHIFT_LEFT:
+    case FN_SHIFT_RIGHT: {
+      if (out == output->data) {
+        o_end = o;
+        break;
+      }
+
+      u8 value = out[-1];
+      for (u32 i = (ch >> 4) + 1; i; --i) {
+        value = (ch & 0x0F) == FN_SHIFT_LEFT ? (value << 1) | (value >> 7) : (value >> 1) | (value << 7);
+        *out++ = value;
+      }
+      break;
+    }
+
+    case FN_OFFSET_SEGMENT:
+    case FN_JUMPING_SEGMENT: {
+      const u32 count = read_byte(&p, p_end) + 1;
+      if (!split) { l = p; }
+
+      if (count > l_end - l) {
+        o_end = o;
+        break;
+      }
+
+      // an offset segment adds every half to the offset, a jumping one to the previous value
+      const bool jumping = (ch & 0x0F) == FN_JUMPING_SEGMENT;
+      u8 value = ch & 0xF0;
+      for (u32 i = 0; i < count; ++i) {
+        const u8 high = l[i] >> 4;
+        const u8 low = l[i] & 0x0F;
+
+        out[0] = jumping ? (value += high - 8 + (high > 7)) : value + high;
+        out[1] = jumping ? (value += low - 8 + (low > 7)) : value + low;
+        out += 2;
+      }
+
+      l += count;
+      break;
+    }
+    }
+
+    // literals are the last bytes of a token that isn't split, when it has any
+    if (!split) { o = l > p ? l : p; }
 
-  fwrite(decompress_dictionary[i].data, sizeof(u8), decompress_dictionary[i].length, output);
+    if (output->stats) {
+      output->stats->tokens[token].count++;
+      output->stats->tokens[token].covered_bytes += out - token_start;
+    }
+  }
+
+  output->size = out - output->data;
+  return o_end == input->opcodes_end;
 }
 
-void one_particular_byte(FILE *input, FILE *output)
+// The dictionary and the tokens of an entropy coded stream are decoded whole:
+// 32[size] 32[coded size] 8[coded..]. NULL when they can't be decoded.
+u8 *decode_entropy_coded(const u8 *input, u32 input_size, u32 *size)
 {
-  putc((getc(input) >> 4) * 0x11, output);
+  if (input_size < 2 * sizeof(u32)) { return NULL; }
+
+  u32 coded_size;
+  memcpy(size, input, sizeof(u32));
+  memcpy(&coded_size, input + sizeof(u32), sizeof(u32));
+  if (!*size || *size > EC_SIZE_LIMIT || coded_size > input_size - 2 * sizeof(u32)) { return NULL; }
+
+  u8 *const decoded = malloc(*size * sizeof(u8));
+  if (!huffman_decode(input + 2 * sizeof(u32), coded_size, decoded, *size)) {
+    free(decoded);
+    return NULL;
+  }
+
+  return decoded;
 }
 
-void arithmetic_progression(FILE *input, FILE *output)
+// A section of a split stream: v[size] v[coded size, 0 when it's as it is] 8[bytes..]. One
+// that's coded is decoded whole into 'decoded', which is to be freed, any other is read where
+// it is. False when it can't be decoded.
+bool read_section(const u8 **input, const u8 *end, const u8 **section, u32 *size, u8 **decoded)
 {
-  fseek(output, -1, SEEK_CUR);
-  u8 value = getc(output);
+  *size = read_varint(input, end);
+  const u32 coded_size = read_varint(input, end);
+  *decoded = NULL;
 
-  u8 i = (getc(input) >> 4) + 1;
-  const u8 factor = getc(input);
+  if (!coded_size) {
+    if (*size > end - *input) { return false; }
 
-  while (i--) {
-    putc(value += factor, output);
+    *section = *input;
+    *input += *size;
+    return true;
   }
+
+  if (*size > EC_SIZE_LIMIT || coded_size > end - *input) { return false; }
+
+  *decoded = malloc(*size * sizeof(u8));
+  if (!huffman_decode(*input, coded_size, *decoded, *size)) { return false; }
+
+  *section = *decoded;
+  *input += coded_size;
+  return true;
 }
 
-void geometric_progression(FILE *input, FILE *output)
+// Decodes a single stream that is entirely in 'input', starting with its magic header; since
+// version 0xA the header is followed by the back-reference window log, which bounds the history
+// to keep, and tells whether the rest of the stream is entropy coded or split in sections.
+// Version 0xC is followed by the id of the shared dictionary it was compressed with, instead of
+// a dictionary of its own; it returns false, without decoding anything, without that
+// dictionary, or when it's corrupted, after decoding its tokens up to the corrupted one.
+bool decompress_stream(const u8 *input, u32 size, decompress_output *output)
 {
-  fseek(output, -1, SEEK_CUR);
-  u8 value = getc(output);
+  if (size < 3 || input[0] != 0xBC) { return false; }
+
+  u16 header;
+  memcpy(&header, input + 1, sizeof(u16));
+  const u8 version = header & 0x0F;
+  if (version < 0x9 || version > 0xC || version == 0xB) { return false; }
+
+  const u8 *end = input + size;
+  input += 3;
+
+  u32 history_limit = DO_HISTORY_LIMIT_V1;
+  bool entropy_coded = false;
+  bool split = false;
+  if (version >= 0xA) {
+    if (input == end) { return false; }
+
+    const u8 window_log = *input++;
+    entropy_coded = window_log & ENTROPY_CODED;
+    split = window_log & SPLIT_SECTIONS;
+
+    const u8 log = window_log & ~(ENTROPY_CODED | SPLIT_SECTIONS);
+    history_limit = 1u << (log < BCZIP_WINDOW_LOG_MAX ? log : BCZIP_WINDOW_LOG_MAX);
+  }
+
+  const shared_dictionary *const shared = output->shared_dictionary;
+  if (version == 0xC) {
+    u32 id = 0;
+    if (end - input >= sizeof(u32)) { memcpy(&id, input, sizeof(u32)); }
+    if (!shared || !shared->id || id != shared->id) { return false; }
+
+    input += sizeof(u32);
+  }
+
+  const double entropy_start = seconds();
+  u8 *decoded = NULL;
+  if (entropy_coded) {
+    u32 decoded_size;
+    if (!(decoded = decode_entropy_coded(input, end - input, &decoded_size))) { return false; }
+
+    input = decoded;
+    end = decoded + decoded_size;
+  }
+
+  // a stream that isn't split has its dictionary, then its tokens
+  const u8 *sections[SPLIT_SECTIONS_COUNT] = {input, input, input, input};
+  u32 sections_sizes[SPLIT_SECTIONS_COUNT] = {end - input};
+  u8 *sections_decoded[SPLIT_SECTIONS_COUNT] = {NULL};
+
+  bool valid = true;
+  for (u8 i = 0; split && valid && i < SPLIT_SECTIONS_COUNT; ++i) {
+    valid = read_section(&input, end, sections + i, sections_sizes + i, sections_decoded + i);
+  }
+
+  if (!valid) {
+    for (u8 i = 0; i < SPLIT_SECTIONS_COUNT; ++i) {
+      free(sections_decoded[i]);
+    }
+    free(decoded);
+    return false;
+  }
 
-  u8 i = (getc(input) >> 4) + 1;
-  const u8 factor = getc(input);
+  // streams never look back into each other
+  output->history_limit = history_limit;
+  output->size = 0;
+  output->written = 0;
 
-  while (i--) {
-    putc(value *= factor, output);
+  const double start = seconds();
+  u32 dictionary_length = 0;
+  if (version == 0xC) {
+    output->dictionary = shared->items;
+    output->dictionary_size = shared->items_count;
+  } else {
+    dictionary_length = create_decompress_dictionary(sections[0], sections_sizes[0], output, header);
   }
+
+  const double dictionary_end = seconds();
+  token_input tokens;
+  if (split) {
+    tokens = (token_input){sections[1], sections[1] + sections_sizes[1], sections[2], sections[2] + sections_sizes[2],
+                           sections[3], sections[3] + sections_sizes[3], true};
+  } else {
+    const u8 *const tokens_start = sections[0] + dictionary_length;
+    tokens = (token_input){tokens_start, end, tokens_start, end, tokens_start, end, false};
+  }
+
+  const bool decoded_tokens = decompress_tokens(&tokens, output);
+
+  if (version == 0xC) {
+    output->dictionary = NULL;
+    output->dictionary_size = 0;
+  } else {
+    delete_decompress_dictionary(output);
+  }
+
+  for (u8 i = 0; i < SPLIT_SECTIONS_COUNT; ++i) {
+    free(sections_decoded[i]);
+  }
+  free(decoded);
+
+  if (output->stats) {
+    output->stats->entropy_seconds += start - entropy_start;
+    output->stats->dictionary_seconds += dictionary_end - start;
+    output->stats->tokens_seconds += seconds() - dictionary_end;
+  }
+
+  output_flush(output);
+  return decoded_tokens;
 }
 
-void fibonacci_progression(FILE *input, FILE *output)
+// Reads the rest of a single stream whose magic header has already been read, and puts the
+// header back in front of it, into the frame buffer. A single stream is never larger than a
+// block, so it's read whole before it's decoded. Returns its size.
+u32 read_single_stream(decompressor *decompressor, FILE *input, u16 header)
 {
-  fseek(output, -2, SEEK_CUR);
-  u8 first = getc(output);
-  u8 second = getc(output);
-  u8 next;
+  if (decompressor->frame_capacity < DO_CAPACITY_MIN) {
+    decompressor->frame_capacity = DO_CAPACITY_MIN;
+    decompressor->frame = realloc(decompressor->frame, decompressor->frame_capacity * sizeof(u8));
+  }
+
+  decompressor->frame[0] = 0xBC;
+  memcpy(decompressor->frame + 1, &header, sizeof(u16));
+  u32 size = 3;
 
-  for (i8 i = (getc(input) + 1) >> 4; i >= 0; --i) {
-    next = first + second;
-    first = second;
-    second = next;
-    putc(next, output);
+  for (;;) {
+    if (size == decompressor->frame_capacity) {
+      decompressor->frame_capacity *= 2;
+      decompressor->frame = realloc(decompressor->frame, decompressor->frame_capacity * sizeof(u8));
+    }
+
+    const u32 length = fread(decompressor->frame + size, sizeof(u8), decompressor->frame_capacity - size, input);
+    if (!length) { break; }
+
+    size += length;
   }
+
+  return size;
 }
 
-void shift_left(FILE *input, FILE *output)
+// the id of the shared dictionary of the stream starting at the input's position, 0 for none
+u32 read_dictionary_id(FILE *input)
 {
-  fseek(output, -1, SEEK_CUR);
-  u8 value = getc(output);
+  if (getc(input) != 0xBC) { return 0; }
 
-  for (i8 i = getc(input) >> 4; i >= 0; --i) {
-    value = (value << 1) | (value >> 7);
-    putc(value, output);
+  u16 header = 0;
+  fread(&header, sizeof(u16), 1, input);
+  if ((header & 0x0F) != 0xC) { return 0; }
+
+  getc(input); // window log
+  return read_u32(input);
+}
+
+// NULL when the block is corrupted or doesn't decode to the length its frame gives
+u8 *decompress_block_data(decompress_block *block)
+{
+  decompress_output output;
+  create_block_output(&output, block->output_length);
+  output.stats = &block->stats;
+  output.shared_dictionary = block->shared_dictionary;
+
+  if (!decompress_stream(block->input, block->input_length, &output) || output.size != block->output_length) {
+    free(output.data);
+    return NULL;
   }
+
+  return output.data;
 }
 
-void shift_right(FILE *input, FILE *output)
+// Places every block of a block file: the index footer gives all of them with a couple of
+// seeks, files without one have their frame headers read one by one. Output offsets are
+// relative to the start of the decompressed data. False, with no blocks, when a block doesn't
+// fit before the index, or the end of a file without one, or is longer than a block can be.
+bool read_block_index(FILE *input, decompress_block **blocks, u32 *blocks_size)
 {
-  fseek(output, -1, SEEK_CUR);
-  u8 value = getc(output);
+  u32 blocks_capacity = 16;
+  *blocks = malloc(blocks_capacity * sizeof(decompress_block));
+  *blocks_size = 0;
+
+  fseek(input, 0, SEEK_END);
+  const i64 input_size = ftell(input);
+
+  u32 footer[2] = {0};
+  if (input_size >= 3 + 8 + 8) {
+    fseek(input, -8, SEEK_END);
+    fread(footer, sizeof(u32), 2, input);
+  }
+
+  const i64 index_offset = input_size - 8 - (i64)footer[0] * 8;
+  const bool indexed = footer[1] == INDEX_FOOTER_MAGIC && index_offset >= 3 + 8;
+
+  // the frames end with an empty one, right before the index
+  const i64 frames_end = indexed ? index_offset - 8 : input_size;
+
+  fseek(input, indexed ? index_offset : 3, SEEK_SET);
+
+  i64 input_offset = 3 + 8;
+  i64 output_offset = 0;
+
+  for (u32 i = 0; !indexed || i < footer[0]; ++i) {
+    const u32 output_length = read_u32(input);
+    const u32 input_length = read_u32(input);
+    if (!input_length) { break; }
+
+    if (input_offset + input_length > frames_end || output_length > DO_SIZE_LIMIT) {
+      free(*blocks);
+      *blocks = NULL;
+      *blocks_size = 0;
+      return false;
+    }
 
-  for (i8 i = getc(input) >> 4; i >= 0; --i) {
-    value = (value >> 1) | (value << 7);
-    putc(value, output);
+    if (*blocks_size == blocks_capacity) {
+      blocks_capacity *= 2;
+      *blocks = realloc(*blocks, blocks_capacity * sizeof(decompress_block));
+    }
+
+    (*blocks)[(*blocks_size)++] = (decompress_block){NULL, input_offset, input_length, output_length, output_offset, -1};
+
+    input_offset += input_length + 8;
+    output_offset += output_length;
+    if (!indexed) { fseek(input, input_length, SEEK_CUR); }
   }
+
+  return true;
 }
 
-void offset_segment(FILE *input, FILE *output)
+// a block is decoded from memory into its own region, which is then written at the
+// block's place in the output; a corrupted block writes nothing
+void decompress_block_task(void *block_pointer)
 {
-  const u8 offset = getc(input) & 0xF0;
-  for (i16 i = getc(input); i >= 0; --i) {
-    const u8 ch = getc(input);
-    putc((ch >> 4) + offset, output);
-    putc((ch & 0x0F) + offset, output);
+  decompress_block *const block = block_pointer;
+  u8 *const region = decompress_block_data(block);
+  block->decompressed = region;
+  if (!region) { return; }
+
+  for (u32 written = 0; written < block->output_length;) {
+    const i64 length = pwrite(block->output_fd, region + written, block->output_length - written,
+                              block->output_offset + written);
+    if (length <= 0) { break; }
+
+    written += length;
   }
+
+  free(region);
 }
 
-void jumping_segment(FILE *input, FILE *output)
+// The index places every block in the output, then blocks are decoded in batches by a
+// thread pool. False, before anything is written, when the index is corrupted or without the
+// dictionary some block needs, and, after the batch it's in, when a block is corrupted, like
+// when they're decoded one after another.
+bool decompress_blocks(decompressor *decompressor, FILE *input, FILE *output)
 {
-  u8 value = getc(input) & 0xF0;
-  for (i16 i = getc(input); i >= 0; --i) {
-    const u8 ch = getc(input);
+  decompress_block *blocks;
+  u32 blocks_size;
+  if (!read_block_index(input, &blocks, &blocks_size)) { return false; }
 
-    value += (ch >> 4) - 8 + ((ch >> 4) > 7);
-    putc(value, output);
+  for (u32 i = 0; i < blocks_size; ++i) {
+    fseek(input, blocks[i].input_offset, SEEK_SET);
+    const u32 id = read_dictionary_id(input);
+    if (id && id != decompressor->shared_dictionary.id) {
+      free(blocks);
+      return false;
+    }
+  }
 
-    value += (ch & 0x0F) - 8 + ((ch & 0x0F) > 7);
-    putc(value, output);
+  fflush(output);
+  const i32 output_fd = fileno(output);
+  const i64 output_start = ftell(output);
+  i64 output_end = output_start;
+
+  for (u32 i = 0; i < blocks_size; ++i) {
+    blocks[i].output_offset += output_start;
+    blocks[i].output_fd = output_fd;
+    blocks[i].shared_dictionary = &decompressor->shared_dictionary;
+    output_end += blocks[i].output_length;
   }
+
+  ftruncate(output_fd, output_end);
+
+  thread_pool *const pool = decompressor->pool;
+  const u32 batch_size = decompressor->threads_count * 2;
+
+  bool decompressed = true;
+  for (u32 batch_start = 0; decompressed && batch_start < blocks_size; batch_start += batch_size) {
+    const u32 batch_end = batch_start + batch_size < blocks_size ? batch_start + batch_size : blocks_size;
+
+    for (u32 i = batch_start; i < batch_end; ++i) {
+      blocks[i].input = malloc(blocks[i].input_length * sizeof(u8));
+      fseek(input, blocks[i].input_offset, SEEK_SET);
+      fread(blocks[i].input, sizeof(u8), blocks[i].input_length, input);
+
+      thread_pool_submit(pool, decompress_block_task, blocks + i);
+    }
+
+    thread_pool_wait(pool);
+
+    for (u32 i = batch_start; i < batch_end; ++i) {
+      add_decompress_stats(&decompressor->stats, &blocks[i].stats);
+      free(blocks[i].input);
+      decompressed &= blocks[i].decompressed;
+    }
+  }
+
+  fseek(output, output_end, SEEK_SET);
+
+  free(blocks);
+  return decompressed;
 }
 
-void create_decompress_dictionary(FILE *input)
+// Writes 'length' bytes of the decompressed data starting at 'start', or as many of them as
+// there are. Only the blocks overlapping the range are decoded; a file that is a single
+// stream is decoded whole. Returns false, after writing the range up to it, when a block is
+// corrupted or doesn't decode to the length its frame gives.
+bool decompress_range(decompressor *decompressor, FILE *input, FILE *output, u64 start, u64 length)
 {
+  decompressor->stats = (bczip_decompress_stats){0};
+
   fseek(input, 1, SEEK_SET);
-  fread(&decompress_dictionary_size, sizeof(u16), 1, input);
-  decompress_dictionary_size >>= 4;
 
-  decompress_dictionary = calloc(decompress_dictionary_size, sizeof(decompress_dictionary_item));
+  u16 header = 0;
+  fread(&header, sizeof(u16), 1, input);
 
-  FILE *const tmp = tmpfile();
-  decompress_dictionary_item item;
-  for (u16 i = 0; i < decompress_dictionary_size; ++i) {
-    fread(&item.length, sizeof(u16), 1, input);
+  decompress_block *blocks;
+  u32 blocks_size;
 
-    if (item.length & 0x8000) {
-      item.length &= 0x7FFF;
+  if ((header & 0x0F) != 0xB) {
+    fseek(input, 0, SEEK_END);
 
-      rewind(tmp);
-      for (u32 end = ftell(input) + item.length; ftell(input) < end;) {
-        const u8 ch = getc(input);
-        ungetc(ch, input);
-        DECOMPRESS_FUNCTIONS[ch & 0x0F](input, tmp);
-      }
+    blocks = malloc(sizeof(decompress_block));
+    blocks[0] = (decompress_block){NULL, 0, ftell(input), 0, 0, -1};
+    blocks_size = 1;
+  } else if (!read_block_index(input, &blocks, &blocks_size)) {
+    return false;
+  }
 
-      item.length = ftell(tmp);
-      item.data = malloc(item.length * sizeof(u8));
+  const u64 end = start + length < start ? UINT64_MAX : start + length;
 
-      rewind(tmp);
-      fread(item.data, sizeof(u8), item.length, tmp);
-    } else {
-      item.data = malloc(item.length * sizeof(u8));
-      fread(item.data, sizeof(u8), item.length, input);
+  for (u32 i = 0; i < blocks_size; ++i) {
+    decompress_block *const block = blocks + i;
+
+    if (block->output_length && block->output_offset + block->output_length <= start) { continue; }
+    if (block->output_offset >= end) { break; }
+
+    block->input = malloc(block->input_length * sizeof(u8));
+    fseek(input, block->input_offset, SEEK_SET);
+    const bool read = fread(block->input, sizeof(u8), block->input_length, input) == block->input_length;
+
+    // a single stream doesn't store its decompressed length, it's known once it's decoded
+    decompress_output block_output;
+    create_block_output(&block_output, block->output_length);
+    block_output.stats = &decompressor->stats;
+    block_output.shared_dictionary = &decompressor->shared_dictionary;
+
+    if (!read || !decompress_stream(block->input, block->input_length, &block_output) ||
+        (block->output_length && block_output.size != block->output_length)) {
+      free(block_output.data);
+      free(block->input);
+      free(blocks);
+      return false;
+    }
+
+    const u64 block_start = start > block->output_offset ? start - block->output_offset : 0;
+    u64 block_end = end - block->output_offset;
+    if (block_end > block_output.size) { block_end = block_output.size; }
+
+    if (block_start < block_end) {
+      fwrite(block_output.data + block_start, sizeof(u8), block_end - block_start, output);
     }
 
-    decompress_dictionary[i] = item;
+    free(block_output.data);
+    free(block->input);
   }
 
-  fclose(tmp);
+  free(blocks);
+  return true;
 }
 
-void delete_decompress_dictionary(void)
+// Decodes a whole file, reading the input and writing the output strictly forward unless
+// blocks are decoded in parallel, which needs both to be seekable. Returns false when the
+// input doesn't start with a known magic header, needs a dictionary it wasn't given, or is
+// corrupted.
+bool decompress(decompressor *decompressor, FILE *input, FILE *output)
 {
-  while (decompress_dictionary_size) {
-    free(decompress_dictionary[--decompress_dictionary_size].data);
+  decompressor->stats = (bczip_decompress_stats){0};
+  if (getc(input) != 0xBC) { return false; }
+
+  u16 header = 0;
+  if (fread(&header, sizeof(u16), 1, input) != 1) { return false; }
+
+  const u8 version = header & 0x0F;
+  if (version < 0x9 || version > 0xC) { return false; }
+
+  decompress_output *const stream_output = &decompressor->output;
+  stream_output->file = output;
+  stream_output->stats = &decompressor->stats;
+  stream_output->shared_dictionary = &decompressor->shared_dictionary;
+
+  if (version != 0xB) {
+    const u32 size = read_single_stream(decompressor, input, header);
+    return decompress_stream(decompressor->frame, size, stream_output);
+  }
+
+  // blocks are written at their own offsets, which an appending output would ignore
+  if (decompressor->threads_count > 1 && ftell(input) >= 0 && ftell(output) >= 0 &&
+      !(fcntl(fileno(output), F_GETFL) & O_APPEND)) {
+    return decompress_blocks(decompressor, input, output);
+  }
+
+  // blocks never refer to anything before their own start, so they're decoded one after
+  // another, each read into memory first
+  for (;;) {
+    const u32 uncompressed_length = read_u32(input);
+    const u32 compressed_length = read_u32(input);
+    if (!compressed_length) { break; }
+
+    if (compressed_length > decompressor->frame_capacity) {
+      decompressor->frame_capacity = compressed_length;
+      decompressor->frame = realloc(decompressor->frame, decompressor->frame_capacity * sizeof(u8));
+    }
+
+    if (fread(decompressor->frame, sizeof(u8), compressed_length, input) != compressed_length) { return false; }
+
+    // the bytes of the block are those written out while it was decoded and those left
+    const u64 dropped = stream_output->dropped;
+    if (!decompress_stream(decompressor->frame, compressed_length, stream_output) ||
+        stream_output->dropped - dropped + stream_output->size != uncompressed_length) {
+      return false;
+    }
+
+    // a pipe gets every block as soon as it's decoded
+    fflush(output);
   }
 
-  free(decompress_dictionary);
+  return true;
+}
+
+decompressor *create_decompressor(u32 threads_count, thread_pool *pool)
+{
+  decompressor *const decompressor = calloc(1, sizeof(struct decompressor_t));
+  decompressor->threads_count = threads_count;
+  decompressor->pool = pool;
+  create_decompress_output(&decompressor->output, NULL, DO_HISTORY_LIMIT_V1);
+
+  return decompressor;
+}
+
+void delete_decompressor(decompressor *decompressor)
+{
+  free(decompressor->shared_dictionary.items);
+  free(decompressor->output.data);
+  free(decompressor->frame);
+  free(decompressor);
+}
+
+void get_decompress_stats(const decompressor *decompressor, bczip_decompress_stats *stats)
+{
+  *stats = decompressor->stats;
 }
 
-void decompress(FILE *input, FILE *output)
+// the items point into the dictionary, which must outlive its use; NULL removes the dictionary
+void set_decompressor_dictionary(decompressor *decompressor, const bczip_dictionary *dictionary)
 {
-  create_decompress_dictionary(input);
+  shared_dictionary *const shared = &decompressor->shared_dictionary;
+  free(shared->items);
+  *shared = (shared_dictionary){0};
+
+  if (!dictionary) { return; }
+
+  shared->id = dictionary_id(dictionary);
+  shared->items_count = dictionary_items_count(dictionary);
+  shared->items = malloc(shared->items_count * sizeof(decompress_dictionary_item));
+
+  for (u16 i = 0; i < shared->items_count; ++i) {
+    shared->items[i].data = (u8 *)dictionary_item(dictionary, i, &shared->items[i].length);
+  }
+}
+
+// the id of the shared dictionary a file was compressed with, 0 for none: a single stream has
+// it in its header, a block file in the header of its first block
+u32 input_dictionary_id(FILE *input)
+{
+  rewind(input);
+  if (getc(input) != 0xBC) { return 0; }
+
+  u16 header = 0;
+  fread(&header, sizeof(u16), 1, input);
 
-  i16 ch;
-  while ((ch = getc(input)) != EOF) {
-    fseek(input, -1, SEEK_CUR);
-    DECOMPRESS_FUNCTIONS[ch & 0x0F](input, output);
+  u32 id;
+  if ((header & 0x0F) == 0xB) {
+    fseek(input, 8, SEEK_CUR); // the lengths of the first block
+    id = read_dictionary_id(input);
+  } else {
+    rewind(input);
+    id = read_dictionary_id(input);
   }
 
-  delete_decompress_dictionary();
+  rewind(input);
+  return id;
 }
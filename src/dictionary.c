@@ -0,0 +1,272 @@
+#include "types.h"
+#include <stdlib.h>
+#include <string.h>
+
+extern void create_suffix_array(const u8 *text, u32 length, u32 *suffix_array);
+extern void create_lcp_array(const u8 *text, u32 length, const u32 *suffix_array, u32 *lcp_array);
+
+// A dictionary shared by inputs alike, instead of each of them finding and storing one of its
+// own. Its file is worked from in place, so that it can be mapped once and shared by every
+// process using it: 32[DICTIONARY_MAGIC] 32[id] 32[items count] { 16[length] }.. { 8[data..] }..
+// The id is a hash of the items, it's stored in every stream compressed with the dictionary.
+typedef struct bczip_dictionary_t {
+  u32 id;
+  u16 items_count;
+  const u8 **items;
+  u16 *lengths;
+} bczip_dictionary;
+
+typedef struct dictionary_candidate_t {
+  u32 offset;
+  u32 length;
+  u64 score;
+} dictionary_candidate;
+
+// ================================================================================ external functions
+
+u8 *train_dictionary(const u8 *samples, const usize *sample_sizes, u32 samples_count, usize *dictionary_size);
+bczip_dictionary *create_dictionary(const u8 *data, usize size);
+void delete_dictionary(bczip_dictionary *dictionary);
+u32 dictionary_id(const bczip_dictionary *dictionary);
+u16 dictionary_items_count(const bczip_dictionary *dictionary);
+const u8 *dictionary_item(const bczip_dictionary *dictionary, u16 i, u16 *length);
+
+// ================================================================================ internal functions
+
+static i32 dictionary_candidates_compare(const void *a, const void *b);
+static u32 dictionary_hash(const u8 *data, usize size);
+
+// ================================================================================ internal variables
+
+static const u32 DICTIONARY_MAGIC = 0x54444342; // "BCDT"
+static const u32 DICTIONARY_HEADER_SIZE = 12;
+
+// items are found by their first bytes, like those of a compressed stream, and the last index
+// stands for back-references
+static const u32 TD_ITEM_LENGTH_MIN = 8;
+static const u32 TD_ITEM_LENGTH_MAX = 0x7FFF;
+static const u32 TD_ITEMS_MAX = 0xFFF;
+static const u32 TD_SIZE_LIMIT = 1 << 17;
+static const u32 TD_SAMPLES_LIMIT = 1 << 28;
+
+// ================================================================================ definitions
+
+// Items are found like those of a compressed stream: every run of suffixes sharing at least
+// TD_ITEM_LENGTH_MIN bytes gives the prefix common to the whole run. What counts is in how many
+// samples an item is, since the repeats within a sample are back-references anyway; with a
+// single sample, its repeats stand for the inputs to come. The items saving the most are kept.
+u8 *train_dictionary(const u8 *samples, const usize *sample_sizes, u32 samples_count, usize *dictionary_size)
+{
+  // the samples are cut to what the suffix array can index
+  u32 input_length = 0;
+  u32 count = 0;
+  while (count < samples_count && input_length + sample_sizes[count] <= TD_SAMPLES_LIMIT) {
+    input_length += sample_sizes[count++];
+  }
+
+  dictionary_candidate *candidates = NULL;
+  u32 candidates_count = 0;
+
+  if (input_length >= 2) {
+    u32 *const suffix_array = malloc((input_length + 1) * sizeof(u32));
+    u32 *const lcp_array = malloc(input_length * sizeof(u32));
+
+    create_suffix_array(samples, input_length, suffix_array);
+    create_lcp_array(samples, input_length, suffix_array, lcp_array);
+
+    // every position's sample, and parts as in a stream's dictionary, which end with their sample
+    u32 *const sample_indexes = malloc(input_length * sizeof(u32));
+    u32 *const part_lengths = malloc(input_length * sizeof(u32));
+    {
+      u32 next_offsets[256];
+      for (u16 i = 0; i < 256; ++i) {
+        next_offsets[i] = input_length;
+      }
+
+      u32 sample = count - 1;
+      u32 sample_start = input_length - sample_sizes[sample];
+      for (u32 i = input_length; i-- > 0;) {
+        while (i < sample_start) {
+          sample_start -= sample_sizes[--sample];
+        }
+
+        const u32 sample_end = sample_start + sample_sizes[sample];
+        sample_indexes[i] = sample;
+        part_lengths[i] = (next_offsets[samples[i]] < sample_end ? next_offsets[samples[i]] : sample_end) - i;
+        next_offsets[samples[i]] = i;
+      }
+    }
+
+    u32 *const last_runs = malloc(count * sizeof(u32));
+    memset(last_runs, 0xFF, count * sizeof(u32));
+    u32 candidates_capacity = 0;
+
+    for (u32 group_start = 0, group_end; group_start < input_length; group_start = group_end) {
+      const u8 ch = samples[suffix_array[group_start]];
+
+      group_end = group_start + 1;
+      while (group_end < input_length && samples[suffix_array[group_end]] == ch) {
+        group_end++;
+      }
+
+      for (u32 rank = group_start + 1; rank < group_end; ++rank) {
+        const u32 run_start = rank - 1;
+        u32 length = 0xFFFFFFFF;
+
+        for (; rank < group_end; ++rank) {
+          u32 common_length = lcp_array[rank];
+          if (part_lengths[suffix_array[rank - 1]] < common_length) { common_length = part_lengths[suffix_array[rank - 1]]; }
+          if (part_lengths[suffix_array[rank]] < common_length) { common_length = part_lengths[suffix_array[rank]]; }
+
+          if (common_length < TD_ITEM_LENGTH_MIN) { break; }
+          if (common_length < length) { length = common_length; }
+        }
+
+        if (rank - run_start < 2) { continue; }
+        if (length > TD_ITEM_LENGTH_MAX) { length = TD_ITEM_LENGTH_MAX; }
+
+        u32 uses = rank - run_start;
+        if (count > 1) {
+          uses = 0;
+          for (u32 i = run_start; i < rank; ++i) {
+            const u32 sample = sample_indexes[suffix_array[i]];
+            if (last_runs[sample] == run_start) { continue; }
+
+            last_runs[sample] = run_start;
+            uses++;
+          }
+
+          if (uses < 2) { continue; }
+        }
+
+        if (candidates_count == candidates_capacity) {
+          candidates_capacity = candidates_capacity ? candidates_capacity * 2 : 256;
+          candidates = realloc(candidates, candidates_capacity * sizeof(dictionary_candidate));
+        }
+
+        // a use takes a two-byte token instead of the item
+        candidates[candidates_count++] = (dictionary_candidate){suffix_array[run_start], length, (u64)uses * (length - 2)};
+      }
+    }
+
+    free(last_runs);
+    free(part_lengths);
+    free(sample_indexes);
+    free(lcp_array);
+    free(suffix_array);
+
+    qsort(candidates, candidates_count, sizeof(dictionary_candidate), dictionary_candidates_compare);
+  }
+
+  u32 items_count = 0;
+  u32 items_size = 0;
+  for (u32 i = 0; i < candidates_count && items_count < TD_ITEMS_MAX; ++i) {
+    if (items_size + candidates[i].length > TD_SIZE_LIMIT) { continue; }
+
+    candidates[items_count++] = candidates[i];
+    items_size += candidates[i].length;
+  }
+
+  *dictionary_size = DICTIONARY_HEADER_SIZE + items_count * sizeof(u16) + items_size;
+  u8 *const dictionary = malloc(*dictionary_size * sizeof(u8));
+  u8 *const items = dictionary + DICTIONARY_HEADER_SIZE;
+
+  u8 *data = items + items_count * sizeof(u16);
+  for (u32 i = 0; i < items_count; ++i) {
+    const u16 length = candidates[i].length;
+    memcpy(items + i * sizeof(u16), &length, sizeof(u16));
+    memcpy(data, samples + candidates[i].offset, length);
+    data += length;
+  }
+
+  u32 id = dictionary_hash(items, *dictionary_size - DICTIONARY_HEADER_SIZE);
+  if (!id) { id = 1; }
+
+  memcpy(dictionary, &DICTIONARY_MAGIC, sizeof(u32));
+  memcpy(dictionary + 4, &id, sizeof(u32));
+  memcpy(dictionary + 8, &items_count, sizeof(u32));
+
+  free(candidates);
+  return dictionary;
+}
+
+// NULL when 'data' isn't a dictionary file
+bczip_dictionary *create_dictionary(const u8 *data, usize size)
+{
+  u32 magic;
+  u32 items_count;
+  if (size < DICTIONARY_HEADER_SIZE) { return NULL; }
+
+  memcpy(&magic, data, sizeof(u32));
+  memcpy(&items_count, data + 8, sizeof(u32));
+  if (magic != DICTIONARY_MAGIC || items_count > TD_ITEMS_MAX ||
+      size < DICTIONARY_HEADER_SIZE + items_count * sizeof(u16)) {
+    return NULL;
+  }
+
+  bczip_dictionary *const dictionary = malloc(sizeof(bczip_dictionary));
+  memcpy(&dictionary->id, data + 4, sizeof(u32));
+  dictionary->items_count = items_count;
+  dictionary->items = malloc(items_count * sizeof(const u8 *));
+  dictionary->lengths = malloc(items_count * sizeof(u16));
+
+  usize offset = DICTIONARY_HEADER_SIZE + items_count * sizeof(u16);
+  for (u32 i = 0; i < items_count; ++i) {
+    u16 length;
+    memcpy(&length, data + DICTIONARY_HEADER_SIZE + i * sizeof(u16), sizeof(u16));
+
+    if (length < TD_ITEM_LENGTH_MIN || length > TD_ITEM_LENGTH_MAX || offset + length > size) {
+      delete_dictionary(dictionary);
+      return NULL;
+    }
+
+    dictionary->items[i] = data + offset;
+    dictionary->lengths[i] = length;
+    offset += length;
+  }
+
+  return dictionary;
+}
+
+void delete_dictionary(bczip_dictionary *dictionary)
+{
+  free(dictionary->lengths);
+  free(dictionary->items);
+  free(dictionary);
+}
+
+u32 dictionary_id(const bczip_dictionary *dictionary)
+{
+  return dictionary->id;
+}
+
+u16 dictionary_items_count(const bczip_dictionary *dictionary)
+{
+  return dictionary->items_count;
+}
+
+const u8 *dictionary_item(const bczip_dictionary *dictionary, u16 i, u16 *length)
+{
+  *length = dictionary->lengths[i];
+  return dictionary->items[i];
+}
+
+// by score, then by position in the samples, so that training doesn't depend on qsort
+i32 dictionary_candidates_compare(const void *a, const void *b)
+{
+  const dictionary_candidate *const x = a;
+  const dictionary_candidate *const y = b;
+  if (x->score != y->score) { return x->score < y->score ? 1 : -1; }
+  return x->offset < y->offset ? -1 : x->offset > y->offset;
+}
+
+// FNV-1a
+u32 dictionary_hash(const u8 *data, usize size)
+{
+  u32 hash = 0x811C9DC5;
+  for (usize i = 0; i < size; ++i) {
+    hash = (hash ^ data[i]) * 0x01000193;
+  }
+
+  return hash;
+}
@@ -0,0 +1,249 @@
+#include "types.h"
+#include <string.h>
+
+// Canonical Huffman codes of bytes, limited to HUFFMAN_LENGTH_LIMIT bits so that a single
+// lookup in a table of 2^HUFFMAN_LENGTH_LIMIT entries decodes any of them. Codes are written
+// from the lowest bit of every byte up, the code of every byte reversed, so that the decoder
+// looks the next code up with the low bits of a word loaded from any bit position:
+// { 4[length of byte 2i] 4[length of byte 2i+1] }..128 { bits.. }
+
+// ================================================================================ external functions
+
+u32 huffman_encode(const u8 *data, u32 size, u8 *output, u32 capacity);
+bool huffman_decode(const u8 *input, u32 input_size, u8 *output, u32 output_size);
+
+// ================================================================================ internal functions
+
+static void huffman_lengths(const u32 *counts, u8 *lengths);
+static bool huffman_codes(const u8 *lengths, u16 *codes);
+
+// ================================================================================ internal variables
+
+#define HUFFMAN_LENGTH_LIMIT 11
+
+static const u32 HUFFMAN_LENGTHS_SIZE = 128;
+
+// ================================================================================ definitions
+
+// Returns the size of the coded data, or 0 when it would take more than 'capacity' bytes, in
+// which case nothing is written. Words are written whole, so 'output' must have 8 bytes more.
+u32 huffman_encode(const u8 *data, u32 size, u8 *output, u32 capacity)
+{
+  u32 counts[256] = {0};
+  for (u32 i = 0; i < size; ++i) {
+    counts[data[i]]++;
+  }
+
+  u8 lengths[256];
+  huffman_lengths(counts, lengths);
+
+  u64 bits_count = 0;
+  for (u16 i = 0; i < 256; ++i) {
+    bits_count += (u64)counts[i] * lengths[i];
+  }
+
+  const u64 coded_size = HUFFMAN_LENGTHS_SIZE + (bits_count + 7) / 8;
+  if (coded_size > capacity) { return 0; }
+
+  u16 codes[256];
+  huffman_codes(lengths, codes);
+
+  for (u16 i = 0; i < HUFFMAN_LENGTHS_SIZE; ++i) {
+    output[i] = lengths[2 * i] | (lengths[2 * i + 1] << 4);
+  }
+
+  // four codes fit in a word along with the bits of a partial byte
+  u8 *out = output + HUFFMAN_LENGTHS_SIZE;
+  u64 bits = 0;
+  u32 count = 0;
+
+  u32 i = 0;
+  for (; i + 4 <= size; i += 4) {
+    for (u8 j = 0; j < 4; ++j) {
+      bits |= (u64)codes[data[i + j]] << count;
+      count += lengths[data[i + j]];
+    }
+
+    memcpy(out, &bits, sizeof(u64));
+    out += count >> 3;
+    bits >>= count & ~7u;
+    count &= 7;
+  }
+
+  for (; i < size; ++i) {
+    bits |= (u64)codes[data[i]] << count;
+    count += lengths[data[i]];
+  }
+
+  memcpy(out, &bits, sizeof(u64));
+  return coded_size;
+}
+
+// false when 'input' isn't the coded data of 'output_size' bytes
+bool huffman_decode(const u8 *input, u32 input_size, u8 *output, u32 output_size)
+{
+  if (input_size < HUFFMAN_LENGTHS_SIZE) { return false; }
+
+  u8 lengths[256];
+  for (u16 i = 0; i < HUFFMAN_LENGTHS_SIZE; ++i) {
+    lengths[2 * i] = input[i] & 0x0F;
+    lengths[2 * i + 1] = input[i] >> 4;
+  }
+
+  u16 codes[256];
+  if (!huffman_codes(lengths, codes)) { return false; }
+
+  // every entry has the byte and the length of the code its low bits start with
+  u16 table[1 << HUFFMAN_LENGTH_LIMIT] = {0};
+  for (u16 i = 0; i < 256; ++i) {
+    if (!lengths[i]) { continue; }
+
+    for (u32 j = codes[i]; j < 1 << HUFFMAN_LENGTH_LIMIT; j += 1 << lengths[i]) {
+      table[j] = (lengths[i] << 8) | i;
+    }
+  }
+
+  const u8 *const bytes = input + HUFFMAN_LENGTHS_SIZE;
+  const u32 size = input_size - HUFFMAN_LENGTHS_SIZE;
+  const u32 mask = (1 << HUFFMAN_LENGTH_LIMIT) - 1;
+  u8 *out = output;
+  u8 *const end = output + output_size;
+  u64 position = 0; // in bits
+
+  // a word loaded at any bit position has at least 57 bits, enough for four codes
+  while (end - out >= 4 && (position >> 3) + 8 <= size) {
+    u64 bits;
+    memcpy(&bits, bytes + (position >> 3), sizeof(u64));
+    bits >>= position & 7;
+
+    for (u8 j = 0; j < 4; ++j) {
+      const u16 entry = table[bits & mask];
+      *out++ = entry;
+      bits >>= entry >> 8;
+      position += entry >> 8;
+    }
+  }
+
+  // the last codes are read from a copy of the last bytes
+  while (out < end) {
+    u64 bits = 0;
+    if ((position >> 3) < size) {
+      const u32 left = size - (position >> 3);
+      memcpy(&bits, bytes + (position >> 3), left < sizeof(u64) ? left : sizeof(u64));
+      bits >>= position & 7;
+    }
+
+    const u16 entry = table[bits & mask];
+    *out++ = entry;
+    position += entry >> 8;
+  }
+
+  return position <= (u64)size * 8;
+}
+
+// Huffman code lengths, merging the two lightest nodes until one is left: leaves are sorted by
+// count and the merged nodes come out in the order of their counts, so the lightest ones are
+// always at the front of either list. Lengths past the limit are cut to it, then the codes of
+// the rarest bytes are made longer until the lengths fit in the code space again.
+void huffman_lengths(const u32 *counts, u8 *lengths)
+{
+  memset(lengths, 0, 256 * sizeof(u8));
+
+  u16 symbols[256];
+  u16 n = 0;
+  for (u16 i = 0; i < 256; ++i) {
+    if (counts[i]) { symbols[n++] = i; }
+  }
+
+  if (!n) { return; }
+  if (n == 1) {
+    lengths[symbols[0]] = 1;
+    return;
+  }
+
+  // insertion sort, stable, so that equal counts keep the order of their bytes
+  for (u16 i = 1; i < n; ++i) {
+    const u16 symbol = symbols[i];
+    u16 j = i;
+    for (; j && counts[symbols[j - 1]] > counts[symbol]; --j) {
+      symbols[j] = symbols[j - 1];
+    }
+    symbols[j] = symbol;
+  }
+
+  u64 weights[511];
+  u16 parents[511];
+  u8 depths[511];
+  for (u16 i = 0; i < n; ++i) {
+    weights[i] = counts[symbols[i]];
+  }
+
+  u16 leaf = 0;
+  u16 node = n;
+  for (u16 next = n; next < 2 * n - 1; ++next) {
+    weights[next] = 0;
+    for (u8 k = 0; k < 2; ++k) {
+      const u16 child = leaf < n && (node >= next || weights[leaf] <= weights[node]) ? leaf++ : node++;
+      weights[next] += weights[child];
+      parents[child] = next;
+    }
+  }
+
+  // parents always come after their children
+  depths[2 * n - 2] = 0;
+  for (u16 i = 2 * n - 2; i-- > 0;) {
+    depths[i] = depths[parents[i]] + 1;
+  }
+
+  u32 space = 0;
+  for (u16 i = 0; i < n; ++i) {
+    if (depths[i] > HUFFMAN_LENGTH_LIMIT) { depths[i] = HUFFMAN_LENGTH_LIMIT; }
+    space += 1u << (HUFFMAN_LENGTH_LIMIT - depths[i]);
+  }
+
+  while (space > 1u << HUFFMAN_LENGTH_LIMIT) {
+    for (u16 i = 0; i < n && space > 1u << HUFFMAN_LENGTH_LIMIT; ++i) {
+      if (depths[i] == HUFFMAN_LENGTH_LIMIT) { continue; }
+
+      depths[i]++;
+      space -= 1u << (HUFFMAN_LENGTH_LIMIT - depths[i]);
+    }
+  }
+
+  for (u16 i = 0; i < n; ++i) {
+    lengths[symbols[i]] = depths[i];
+  }
+}
+
+// The canonical codes of the lengths, reversed; false when they don't fit in the code space.
+// Codes are handed out from the shortest length to the longest one, by byte.
+bool huffman_codes(const u8 *lengths, u16 *codes)
+{
+  u16 lengths_count[HUFFMAN_LENGTH_LIMIT + 1] = {0};
+  for (u16 i = 0; i < 256; ++i) {
+    if (lengths[i] > HUFFMAN_LENGTH_LIMIT) { return false; }
+    lengths_count[lengths[i]]++;
+  }
+
+  u32 next_codes[HUFFMAN_LENGTH_LIMIT + 1];
+  u32 code = 0;
+  lengths_count[0] = 0;
+  for (u8 length = 1; length <= HUFFMAN_LENGTH_LIMIT; ++length) {
+    code = (code + lengths_count[length - 1]) << 1;
+    next_codes[length] = code;
+  }
+
+  if (code + lengths_count[HUFFMAN_LENGTH_LIMIT] > 1u << HUFFMAN_LENGTH_LIMIT) { return false; }
+
+  for (u16 i = 0; i < 256; ++i) {
+    codes[i] = 0;
+    if (!lengths[i]) { continue; }
+
+    const u32 canonical = next_codes[lengths[i]]++;
+    for (u8 bit = 0; bit < lengths[i]; ++bit) {
+      codes[i] |= ((canonical >> bit) & 1) << (lengths[i] - 1 - bit);
+    }
+  }
+
+  return true;
+}
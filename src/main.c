@@ -1,18 +1,32 @@
+#define _GNU_SOURCE // O_TMPFILE, copy_file_range
+#include "bczip.h"
 #include "types.h"
 #include <ctype.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
 #include <unistd.h>
 
 #define APP_NAME "bczip"
 #define EXT_NAME "bc"
-#define MAGIC_HEADER 0xBC09
+#define MAGIC_HEADER 0xBC0A
+#define MAGIC_HEADER_V1 0xBC09
+#define MAGIC_HEADER_BLOCKS 0xBC0B
+#define MAGIC_HEADER_DICTIONARY 0xBC0C
 
 #define eprintf(...) fprintf(stderr, __VA_ARGS__)
 
-extern void compress(FILE *input, FILE *output);
-extern void decompress(FILE *input, FILE *output);
+typedef struct work_queue_t work_queue;
+extern work_queue *create_work_queue(u32 workers_count, const u32 *tasks, u32 tasks_count);
+extern bool work_queue_take(work_queue *queue, u32 worker, u32 *task);
+extern void delete_work_queue(work_queue *queue);
 
 typedef struct command_line_options_t {
   bool stdout;
@@ -21,10 +35,71 @@ typedef struct command_line_options_t {
   bool help;
   bool keep;
   bool quiet;
+  bool recursive;
   bool verbose;
   bool version;
+  bool stats;
+  bool batch; // several files, which aren't kept in the page cache once processed
+  u32 window_log;
+  u32 block_log;
+  u32 threads_count;
+  u32 level;
+  bool range;
+  u64 range_start;
+  u64 range_length;
+  bool train;
+  const char *train_path; // where --train writes the dictionary
+  const char *dictionary_path;
+  bczip_dictionary *dictionary; // loaded from dictionary_path
 } command_line_options;
 
+// An output is written to a file without a name, in the directory of its final path, and only
+// given that name once it's complete, so that neither a crash nor an error leaves a partial
+// output behind or replaces an existing file with one. Where O_TMPFILE isn't supported, the
+// file has a temporary name next to the final one instead, and is renamed.
+typedef struct output_file_t {
+  FILE *file;
+  char *temporary_path; // NULL while the file has no name
+} output_file;
+
+// inputs are mostly read token by token, the default buffer would take a read every 4 KB
+static const usize INPUT_BUFFER_SIZE = 1 << 20;
+
+typedef struct file_list_t {
+  char **paths;
+  u32 size;
+  u32 capacity;
+} file_list;
+
+// what a file printed while it was processed along with others, kept until the files before
+// it are done, so that everything is printed in the order of the files
+typedef struct file_report_t {
+  char *out;
+  usize out_size;
+  FILE *out_stream;
+  char *err;
+  usize err_size;
+  FILE *err_stream;
+  FILE *destination; // the data written with -c
+  bool processed;
+  bool done;
+} file_report;
+
+typedef struct batch_t {
+  const command_line_options *options;
+  bczip_compress_settings settings;
+  const file_list *files;
+  file_report *reports;
+  u32 reports_printed;
+  work_queue *queue;
+  pthread_mutex_t mutex;
+} batch;
+
+typedef struct batch_worker_t {
+  batch *batch;
+  u32 index;
+} batch_worker;
+
 static void print_help(void)
 {
   puts(
@@ -38,8 +113,23 @@ static void print_help(void)
     "  -h, --help        give this help\n"
     "  -k, --keep        keep (don't delete) input files\n"
     "  -q, --quiet       suppress all warnings\n"
+    "  -r, --recursive   operate recursively on directories\n"
     "  -v, --verbose     verbose mode\n"
     "  -V, --version     display version number\n"
+    "  -1, --fast        compress faster\n"
+    "  -9, --best        compress better\n"
+    "  -T, --threads=N   (de)compress files and blocks with N threads\n"
+    "                    (0: one per processor)\n"
+    "      --block=LOG   split inputs into independent blocks of 2^LOG bytes\n"
+    "                    (16-30, default 20)\n"
+    "      --window=LOG  look for back-references up to 2^LOG bytes back\n"
+    "                    (10-24, default 20)\n"
+    "      --range=START:LEN\n"
+    "                    decompress only LEN bytes at offset START to standard output\n"
+    "      --stats       print the tokens of every file and the time spent on it\n"
+    "      --train       make a dictionary from the FILEs, for inputs like them\n"
+    "  -o FILE           where --train writes the dictionary\n"
+    "      --dict=FILE   (de)compress with a dictionary made by --train\n"
     "\n"
     "With no FILE, read standard input.");
 }
@@ -57,20 +147,683 @@ static bool file_exist(const char *filepath)
   return true;
 }
 
+static bool parse_number(const char *str, u32 min, u32 max, u32 *value)
+{
+  char *end;
+  const long number = strtol(str, &end, 10);
+  if (*end || end == str || number < min || number > max) { return false; }
+
+  *value = number;
+  return true;
+}
+
+static bool parse_range(const char *str, u64 *start, u64 *length)
+{
+  if (!isdigit(*str)) { return false; }
+
+  char *end;
+  *start = strtoull(str, &end, 10);
+  if (*end != ':' || !isdigit(end[1])) { return false; }
+
+  *length = strtoull(end + 1, &end, 10);
+  return !*end;
+}
+
+// every check tried on a part of the input, with the share of the input it was tried on
+static void print_checks(const bczip_ctx *ctx, const char *filepath, FILE *out)
+{
+  bczip_compress_stats stats;
+  bczip_get_compress_stats(ctx, &stats);
+  // nothing to tell when every check of the level was tried everywhere, the others never are
+  bool pruned = false;
+  for (u32 i = 0; i < BCZIP_CHECKS_COUNT; ++i) {
+    pruned |= stats.check_segments_count[i] && stats.check_segments_count[i] < stats.segments_count;
+  }
+  if (!pruned) { return; }
+
+  fprintf(out, APP_NAME ": '%s'\tchecks:", filepath);
+  const char *separator = " ";
+  for (u32 i = 0; i < BCZIP_CHECKS_COUNT; ++i) {
+    if (!stats.check_segments_count[i]) { continue; }
+
+    fprintf(out, "%s%s %.0f%%", separator, bczip_check_name(i), 100.0 * stats.check_segments_count[i] / stats.segments_count);
+    separator = ", ";
+  }
+
+  fputc('\n', out);
+}
+
+// every kind of token checked for or found, then the time of every phase
+static void print_compress_stats(const bczip_ctx *ctx, const char *filepath, FILE *err)
+{
+  bczip_compress_stats stats;
+  bczip_get_compress_stats(ctx, &stats);
+
+  fprintf(err, APP_NAME ": '%s'\tstats:\n", filepath);
+  fprintf(err, "  %-24s %12s %12s %12s %12s\n", "token", "checks", "count", "covered", "emitted");
+  for (u32 i = 0; i < BCZIP_TOKENS_COUNT; ++i) {
+    const bczip_token_stats *const token = stats.tokens + i;
+    if (!token->checks_count && !token->count) { continue; }
+
+    fprintf(err, "  %-24s %12llu %12llu %12llu %12llu\n", bczip_token_name(i), (unsigned long long)token->checks_count,
+            (unsigned long long)token->count, (unsigned long long)token->covered_bytes,
+            (unsigned long long)token->emitted_bytes);
+  }
+
+  fprintf(err, "  %-24s %12.3fs\n", "create dictionary", stats.dictionary_seconds);
+  fprintf(err, "  %-24s %12.3fs\n", "parse", stats.parse_seconds);
+  fprintf(err, "  %-24s %12.3fs\n", "optimize dictionary", stats.optimize_seconds);
+  fprintf(err, "  %-24s %12.3fs\n", "write", stats.write_seconds);
+  fprintf(err, "  %-24s %12.3fs\n", "entropy coding", stats.entropy_seconds);
+  fprintf(err, "  %-24s %12llu (%llu bytes)\n", "dictionary items found", (unsigned long long)stats.dictionary_items_count,
+          (unsigned long long)stats.dictionary_bytes);
+  fprintf(err, "  %-24s %12llu (%llu bytes)\n", "dictionary items written",
+          (unsigned long long)stats.written_dictionary_items_count, (unsigned long long)stats.written_dictionary_bytes);
+  fprintf(err, "  %-24s %12llu (from %llu bytes)\n", "entropy coded bytes", (unsigned long long)stats.entropy_output_bytes,
+          (unsigned long long)stats.entropy_input_bytes);
+}
+
+static void print_decompress_stats(const bczip_ctx *ctx, const char *filepath, FILE *err)
+{
+  bczip_decompress_stats stats;
+  bczip_get_decompress_stats(ctx, &stats);
+
+  fprintf(err, APP_NAME ": '%s'\tstats:\n", filepath);
+  fprintf(err, "  %-24s %12s %12s\n", "token", "count", "covered");
+  for (u32 i = 0; i < BCZIP_TOKENS_COUNT; ++i) {
+    const bczip_token_stats *const token = stats.tokens + i;
+    if (!token->count) { continue; }
+
+    fprintf(err, "  %-24s %12llu %12llu\n", bczip_token_name(i), (unsigned long long)token->count,
+            (unsigned long long)token->covered_bytes);
+  }
+
+  fprintf(err, "  %-24s %12.3fs\n", "decode entropy", stats.entropy_seconds);
+  fprintf(err, "  %-24s %12.3fs\n", "decode dictionary", stats.dictionary_seconds);
+  fprintf(err, "  %-24s %12.3fs\n", "decode tokens", stats.tokens_seconds);
+}
+
 static bool magic_header_valid(FILE *compressed_file)
 {
   rewind(compressed_file);
-  return (getc(compressed_file) << 8) + (getc(compressed_file) & 0x0F) == MAGIC_HEADER;
+  const u16 magic_header = (getc(compressed_file) << 8) + (getc(compressed_file) & 0x0F);
+  return magic_header >= MAGIC_HEADER_V1 && magic_header <= MAGIC_HEADER_DICTIONARY;
+}
+
+// a compressed file needs the dictionary it was compressed with, if any
+static bool dictionary_given(const command_line_options *options, FILE *compressed_file, const char *filepath,
+                             FILE *err)
+{
+  const u32 id = bczip_get_dictionary_id(compressed_file);
+  if (!id || (options->dictionary && bczip_dictionary_id(options->dictionary) == id)) { return true; }
+
+  if (!options->quiet) { fprintf(err, APP_NAME ": '%s' needs dictionary %08x\n", filepath, id); }
+  return false;
+}
+
+static bool confirm_overwrite(const char *output_pathname, FILE *out, bool interactive)
+{
+  // files processed in parallel can't ask, their existing outputs are only replaced by force
+  if (!interactive) {
+    fprintf(out, APP_NAME ": '%s' already exists;\tnot overwritten\n", output_pathname);
+    return false;
+  }
+
+  fprintf(out, APP_NAME ": '%s' already exists; do you want to overwrite (y/N)? ", output_pathname);
+  i16 ch = getchar();
+
+  i16 c = ch;
+  while (c != EOF && c != '\n') {
+    c = getchar();
+  }
+
+  if (tolower(ch) != 'y') {
+    fputs("\tnot overwritten\n", out);
+    return false;
+  }
+
+  return true;
+}
+
+static bool has_extension(const char *filepath)
+{
+  const usize length = strlen(filepath);
+  return length > strlen(EXT_NAME) + 1 && !strcmp(filepath + length - strlen(EXT_NAME) - 1, "." EXT_NAME);
+}
+
+// Copies what's left of 'input' to 'output', from and to their file offsets. Between files the
+// kernel copies the data itself, without it going through a buffer here; only what neither
+// copy_file_range nor sendfile supports, such as a pipe as input, is read and written.
+static void copy_fd(i32 input, i32 output)
+{
+  const usize chunk = 1 << 30;
+  ssize_t length;
+
+  while ((length = copy_file_range(input, NULL, output, NULL, chunk, 0)) > 0) {}
+  if (!length) { return; }
+
+  while ((length = sendfile(output, input, NULL, chunk)) > 0) {}
+  if (!length) { return; }
+
+  u8 buffer[0x10000];
+  while ((length = read(input, buffer, sizeof(buffer))) > 0) {
+    for (ssize_t written = 0, w; written < length; written += w) {
+      if ((w = write(output, buffer + written, length - written)) < 0) { return; }
+    }
+  }
+}
+
+static bool open_output(output_file *output, const char *path, mode_t mode)
+{
+  output->temporary_path = NULL;
+  i32 fd = -1;
+
+  // a file without a name is given one through /proc, and can't be linked over an existing one
+  if (!access("/proc/self/fd", X_OK) && access(path, F_OK)) {
+    const char *const slash = strrchr(path, '/');
+    char *const directory = slash ? strndup(path, slash - path + 1) : strdup(".");
+    fd = open(directory, O_TMPFILE | O_RDWR, mode);
+    free(directory);
+  }
+
+  if (fd < 0) {
+    output->temporary_path = malloc((strlen(path) + 8) * sizeof(char));
+    sprintf(output->temporary_path, "%s.XXXXXX", path);
+    fd = mkstemp(output->temporary_path);
+    if (fd < 0) {
+      free(output->temporary_path);
+      return false;
+    }
+  }
+
+  fchmod(fd, mode);
+  output->file = fdopen(fd, "wb+");
+  return true;
+}
+
+static void discard_output(output_file *output)
+{
+  fclose(output->file);
+  if (output->temporary_path) {
+    unlink(output->temporary_path);
+    free(output->temporary_path);
+  }
+}
+
+// false when the output couldn't be written entirely, in which case it's discarded
+static bool commit_output(output_file *output, const char *path)
+{
+  if (fflush(output->file) || ferror(output->file)) {
+    discard_output(output);
+    return false;
+  }
+
+  bool committed;
+  if (output->temporary_path) {
+    committed = !rename(output->temporary_path, path);
+  } else {
+    char fd_path[32];
+    sprintf(fd_path, "/proc/self/fd/%d", fileno(output->file));
+    committed = !linkat(AT_FDCWD, fd_path, AT_FDCWD, path, AT_SYMLINK_FOLLOW);
+  }
+
+  if (!committed) {
+    discard_output(output);
+    return false;
+  }
+
+  fclose(output->file);
+  free(output->temporary_path);
+  return true;
+}
+
+// the list takes 'path', which must have been allocated
+static void file_list_add(file_list *files, char *path)
+{
+  if (files->size == files->capacity) {
+    files->capacity = files->capacity ? files->capacity * 2 : 16;
+    files->paths = realloc(files->paths, files->capacity * sizeof(char *));
+  }
+
+  files->paths[files->size++] = path;
+}
+
+static void delete_file_list(file_list *files)
+{
+  while (files->size) {
+    free(files->paths[--files->size]);
+  }
+
+  free(files->paths);
+}
+
+static i32 paths_compare(const void *a, const void *b)
+{
+  return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+// Adds the files under a directory, in the order of their names, so that a directory is
+// always processed the same way. Symbolic links aren't followed, and only the files there is
+// something to do with are added: the compressed ones with -d, the others without.
+static void add_directory_files(file_list *files, const char *directory, bool decompress)
+{
+  DIR *const dir = opendir(directory);
+  if (!dir) { return; }
+
+  const usize directory_length = strlen(directory);
+  const char *const separator = directory_length && directory[directory_length - 1] == '/' ? "" : "/";
+
+  file_list entries = {0};
+  const struct dirent *entry;
+  while ((entry = readdir(dir))) {
+    if (!strcmp(entry->d_name, ".") || !strcmp(entry->d_name, "..")) { continue; }
+
+    char *const path = malloc((directory_length + strlen(entry->d_name) + 2) * sizeof(char));
+    sprintf(path, "%s%s%s", directory, separator, entry->d_name);
+    file_list_add(&entries, path);
+  }
+
+  closedir(dir);
+  qsort(entries.paths, entries.size, sizeof(char *), paths_compare);
+
+  for (u32 i = 0; i < entries.size; ++i) {
+    struct stat status;
+    if (lstat(entries.paths[i], &status)) { continue; }
+
+    if (S_ISDIR(status.st_mode)) {
+      add_directory_files(files, entries.paths[i], decompress);
+    } else if (S_ISREG(status.st_mode) && has_extension(entries.paths[i]) == decompress) {
+      file_list_add(files, entries.paths[i]);
+      entries.paths[i] = NULL;
+    }
+  }
+
+  for (u32 i = 0; i < entries.size; ++i) {
+    free(entries.paths[i]);
+  }
+
+  free(entries.paths);
+}
+
+static FILE *open_input(const char *filepath, char **buffer)
+{
+  FILE *const input = fopen(filepath, "rb");
+  if (!input) { return NULL; }
+
+  *buffer = malloc(INPUT_BUFFER_SIZE * sizeof(char));
+  setvbuf(input, *buffer, _IOFBF, INPUT_BUFFER_SIZE);
+  posix_fadvise(fileno(input), 0, 0, POSIX_FADV_SEQUENTIAL);
+  return input;
+}
+
+static void close_input(FILE *input, char *buffer, bool batch)
+{
+  // the pages of a file read once make the ones of the next files be evicted first
+  if (batch) { posix_fadvise(fileno(input), 0, 0, POSIX_FADV_DONTNEED); }
+  fclose(input);
+  free(buffer);
+}
+
+// (de)compresses a single file, printing to 'out' and 'err'; with -c the data goes to
+// 'destination'. The input is removed only once its output has its final name. False on any
+// error, the input is kept then and a partial output discarded; keeping an existing output
+// instead of overwriting it isn't one.
+static bool process_file(const command_line_options *options, bczip_ctx *ctx, const char *filepath, FILE *out,
+                         FILE *err, FILE *destination, bool interactive)
+{
+  char *input_buffer;
+  FILE *const input = open_input(filepath, &input_buffer);
+  if (!input) {
+    if (options->quiet) { return false; }
+
+    if (errno == EISDIR) {
+      fprintf(err, APP_NAME ": '%s' is a directory\n", filepath);
+    } else {
+      fprintf(err, APP_NAME ": no such file '%s'\n", filepath);
+    }
+    return false;
+  }
+
+  struct stat input_status;
+  if (fstat(fileno(input), &input_status) || S_ISDIR(input_status.st_mode)) {
+    if (!options->quiet) { fprintf(err, APP_NAME ": '%s' is a directory\n", filepath); }
+    close_input(input, input_buffer, false);
+    return false;
+  }
+
+  const u32 input_pathname_length = strlen(filepath);
+  u32 output_pathname_length;
+  char *output_pathname;
+
+  if (options->decompress) {
+    if (input_pathname_length < strlen(EXT_NAME) + 2 ||
+        strcmp(filepath + input_pathname_length - strlen(EXT_NAME) - 1, "." EXT_NAME)) {
+      if (!options->quiet) { fprintf(err, APP_NAME ": '%s' has unknown suffix\n", filepath); }
+      close_input(input, input_buffer, false);
+      return false;
+    }
+
+    if (!magic_header_valid(input)) {
+      if (!options->quiet) { fprintf(err, APP_NAME ": '%s' not in " APP_NAME " format\n", filepath); }
+      close_input(input, input_buffer, false);
+      return false;
+    }
+
+    if (!dictionary_given(options, input, filepath, err)) {
+      close_input(input, input_buffer, false);
+      return false;
+    }
+
+    output_pathname_length = input_pathname_length - strlen(EXT_NAME) - 1;
+    output_pathname = malloc((output_pathname_length + 1) * sizeof(char));
+    memcpy(output_pathname, filepath, output_pathname_length);
+    output_pathname[output_pathname_length] = '\0';
+  } else {
+    if (input_pathname_length > strlen(EXT_NAME) + 1 &&
+        !strcmp(filepath + input_pathname_length - strlen(EXT_NAME) - 1, "." EXT_NAME)) {
+      if (!options->quiet) { fprintf(err, APP_NAME ": '%s' already has '." EXT_NAME "' suffix\n", filepath); }
+      close_input(input, input_buffer, false);
+      return false;
+    }
+
+    output_pathname_length = strlen(filepath) + strlen(EXT_NAME) + 1;
+    output_pathname = malloc((output_pathname_length + 1) * sizeof(char));
+    memcpy(output_pathname, filepath, input_pathname_length + 1);
+    strncat(output_pathname, "." EXT_NAME, strlen(EXT_NAME) + 1);
+  }
+
+  if (!options->force && !options->stdout && file_exist(output_pathname) &&
+      !confirm_overwrite(output_pathname, out, interactive)) {
+    close_input(input, input_buffer, false);
+    free(output_pathname);
+    return true;
+  }
+
+  output_file output_file = {0};
+  if (!options->stdout && !open_output(&output_file, output_pathname, input_status.st_mode & 07777)) {
+    if (!options->quiet) { fprintf(err, APP_NAME ": '%s' can't open output stream\n", filepath); }
+    close_input(input, input_buffer, false);
+    free(output_pathname);
+    return false;
+  }
+  FILE *const output = options->stdout ? destination : output_file.file;
+
+  bool processed = true;
+  if (!options->decompress) {
+    bczip_compress_file(ctx, input, output);
+  } else if (options->range) {
+    processed = bczip_decompress_range(ctx, input, output, options->range_start, options->range_length);
+  } else {
+    rewind(input);
+    processed = bczip_decompress_file(ctx, input, output);
+  }
+
+  if (!processed) {
+    if (!options->quiet) { fprintf(err, APP_NAME ": '%s' not in " APP_NAME " format\n", filepath); }
+    if (!options->stdout) { discard_output(&output_file); }
+    close_input(input, input_buffer, false);
+    free(output_pathname);
+    return false;
+  }
+
+  if (options->stats) {
+    if (options->decompress) {
+      print_decompress_stats(ctx, filepath, err);
+    } else {
+      print_compress_stats(ctx, filepath, err);
+    }
+  }
+
+  if (options->stdout) {
+    close_input(input, input_buffer, options->batch);
+    free(output_pathname);
+    return true;
+  }
+
+  const u64 input_size = input_status.st_size;
+  fseek(output, 0, SEEK_END);
+  const u64 output_size = ftell(output);
+
+  if (!commit_output(&output_file, output_pathname)) {
+    if (!options->quiet) { fprintf(err, APP_NAME ": '%s' can't write '%s'\n", filepath, output_pathname); }
+    close_input(input, input_buffer, false);
+    free(output_pathname);
+    return false;
+  }
+
+  if (options->verbose) {
+    double diff;
+    if (options->decompress) {
+      diff = (double)input_size / output_size;
+    } else {
+      diff = (double)output_size / input_size;
+    }
+
+    fprintf(out, APP_NAME ": '%s'\t%3.1f%% replaced with '%s'\n", filepath, diff * 100, output_pathname);
+    if (!options->decompress) { print_checks(ctx, filepath, out); }
+  }
+
+  close_input(input, input_buffer, options->batch);
+  free(output_pathname);
+
+  if (!options->keep) { remove(filepath); }
+  return true;
+}
+
+// a report is printed once every file before it has been
+static void print_report(file_report *report)
+{
+  fclose(report->out_stream);
+  fclose(report->err_stream);
+
+  fwrite(report->out, sizeof(char), report->out_size, stdout);
+
+  if (report->destination) {
+    fflush(report->destination);
+    fflush(stdout);
+    lseek(fileno(report->destination), 0, SEEK_SET);
+    copy_fd(fileno(report->destination), fileno(stdout));
+    fclose(report->destination);
+  }
+
+  fflush(stdout);
+  fwrite(report->err, sizeof(char), report->err_size, stderr);
+
+  free(report->out);
+  free(report->err);
+}
+
+static void *batch_worker_run(void *worker_pointer)
+{
+  const batch_worker *const worker = worker_pointer;
+  batch *const batch = worker->batch;
+  bczip_ctx *const ctx = bczip_create_ctx(&batch->settings);
+  bczip_set_dictionary(ctx, batch->options->dictionary);
+
+  u32 i;
+  while (work_queue_take(batch->queue, worker->index, &i)) {
+    file_report *const report = batch->reports + i;
+    report->out_stream = open_memstream(&report->out, &report->out_size);
+    report->err_stream = open_memstream(&report->err, &report->err_size);
+    if (batch->options->stdout) { report->destination = tmpfile(); }
+
+    report->processed = process_file(batch->options, ctx, batch->files->paths[i], report->out_stream,
+                                     report->err_stream, report->destination, false);
+
+    pthread_mutex_lock(&batch->mutex);
+    report->done = true;
+    while (batch->reports_printed < batch->files->size && batch->reports[batch->reports_printed].done) {
+      print_report(batch->reports + batch->reports_printed++);
+    }
+    pthread_mutex_unlock(&batch->mutex);
+  }
+
+  bczip_delete_ctx(ctx);
+  return NULL;
+}
+
+typedef struct file_size_t {
+  u64 size;
+  u32 index;
+} file_size;
+
+static i32 file_sizes_compare(const void *a, const void *b)
+{
+  const file_size *const x = a;
+  const file_size *const y = b;
+  if (x->size != y->size) { return x->size < y->size ? 1 : -1; }
+  return x->index < y->index ? -1 : x->index > y->index;
+}
+
+// Files are dealt to the workers from the largest to the smallest, so that the large ones
+// start first and the small ones fill the gaps at the end. Every worker has a context of its
+// own, with an equal share of the threads for the blocks of its files. The main thread is
+// the first worker. False when some file couldn't be decompressed.
+static bool process_files_in_parallel(const command_line_options *options, const bczip_compress_settings *settings,
+                                      const file_list *files, u32 workers_count)
+{
+  batch batch = {options, *settings, files, calloc(files->size, sizeof(file_report)), 0, NULL};
+  batch.settings.threads_count = settings->threads_count / workers_count;
+  pthread_mutex_init(&batch.mutex, NULL);
+
+  {
+    file_size *const sizes = malloc(files->size * sizeof(file_size));
+    for (u32 i = 0; i < files->size; ++i) {
+      struct stat status;
+      sizes[i] = (file_size){stat(files->paths[i], &status) ? 0 : status.st_size, i};
+    }
+
+    qsort(sizes, files->size, sizeof(file_size), file_sizes_compare);
+
+    u32 *const tasks = malloc(files->size * sizeof(u32));
+    for (u32 i = 0; i < files->size; ++i) {
+      tasks[i] = sizes[i].index;
+    }
+
+    batch.queue = create_work_queue(workers_count, tasks, files->size);
+    free(tasks);
+    free(sizes);
+  }
+
+  batch_worker *const workers = malloc(workers_count * sizeof(batch_worker));
+  pthread_t *const threads = malloc(workers_count * sizeof(pthread_t));
+  bool *const started = calloc(workers_count, sizeof(bool));
+
+  for (u32 i = 0; i < workers_count; ++i) {
+    workers[i] = (batch_worker){&batch, i};
+    if (i) { started[i] = !pthread_create(threads + i, NULL, batch_worker_run, workers + i); }
+  }
+
+  // the tasks of a worker that couldn't be started are stolen by the others
+  batch_worker_run(workers);
+
+  for (u32 i = 1; i < workers_count; ++i) {
+    if (started[i]) { pthread_join(threads[i], NULL); }
+  }
+
+  free(started);
+  free(threads);
+  free(workers);
+  bool processed = true;
+  for (u32 i = 0; i < files->size; ++i) {
+    processed &= batch.reports[i].processed;
+  }
+
+  delete_work_queue(batch.queue);
+  pthread_mutex_destroy(&batch.mutex);
+  free(batch.reports);
+  return processed;
+}
+
+// The dictionary file is mapped rather than read, so that the processes using the same one
+// share its pages; the mapping outlives the dictionary, until the process ends.
+static bczip_dictionary *load_dictionary(const char *filepath)
+{
+  const i32 fd = open(filepath, O_RDONLY);
+  if (fd < 0) {
+    eprintf(APP_NAME ": no such file '%s'\n", filepath);
+    return NULL;
+  }
+
+  struct stat status;
+  void *data = MAP_FAILED;
+  if (!fstat(fd, &status) && S_ISREG(status.st_mode) && status.st_size) {
+    data = mmap(NULL, status.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  }
+  close(fd);
+
+  bczip_dictionary *const dictionary = data == MAP_FAILED ? NULL : bczip_load_dictionary(data, status.st_size);
+  if (!dictionary) { eprintf(APP_NAME ": '%s' not a dictionary\n", filepath); }
+  return dictionary;
+}
+
+// the files are the samples of the dictionary, they're read whole and one after the other
+static bool train(const command_line_options *options, const file_list *files)
+{
+  u8 *samples = NULL;
+  usize samples_size = 0;
+  usize *const sample_sizes = malloc(files->size * sizeof(usize));
+  u32 samples_count = 0;
+
+  for (u32 i = 0; i < files->size; ++i) {
+    const i32 fd = open(files->paths[i], O_RDONLY);
+    struct stat status;
+    if (fd < 0 || fstat(fd, &status) || !S_ISREG(status.st_mode)) {
+      if (!options->quiet) { eprintf(APP_NAME ": no such file '%s'\n", files->paths[i]); }
+      if (fd >= 0) { close(fd); }
+      continue;
+    }
+
+    samples = realloc(samples, (samples_size + status.st_size) * sizeof(u8));
+    usize size = 0;
+    for (ssize_t length; size < status.st_size && (length = read(fd, samples + samples_size + size, status.st_size - size)) > 0;) {
+      size += length;
+    }
+    close(fd);
+
+    samples_size += size;
+    sample_sizes[samples_count++] = size;
+  }
+
+  usize dictionary_size;
+  u8 *const dictionary = bczip_train_dictionary(samples, sample_sizes, samples_count, &dictionary_size);
+  free(sample_sizes);
+  free(samples);
+
+  output_file output;
+  bool written = open_output(&output, options->train_path, 0644);
+  if (written) {
+    fwrite(dictionary, sizeof(u8), dictionary_size, output.file);
+    written = commit_output(&output, options->train_path);
+  }
+
+  if (!written) {
+    eprintf(APP_NAME ": can't write '%s'\n", options->train_path);
+  } else if (options->verbose) {
+    bczip_dictionary *const loaded = bczip_load_dictionary(dictionary, dictionary_size);
+    printf(APP_NAME ": '%s'\tdictionary %08x of %llu bytes from %u files\n", options->train_path,
+           bczip_dictionary_id(loaded), (unsigned long long)dictionary_size, samples_count);
+    bczip_delete_dictionary(loaded);
+  }
+
+  free(dictionary);
+  return written;
 }
 
 int main(int argc, char *argv[])
 {
-  command_line_options options = {0};
-  bool no_files = true;
+  command_line_options options = {
+    .window_log = BCZIP_WINDOW_LOG_DEFAULT,
+    .block_log = BCZIP_BLOCK_LOG_DEFAULT,
+    .threads_count = 1,
+    .level = BCZIP_LEVEL_DEFAULT,
+  };
+  const char **const files = malloc(argc * sizeof(char *));
+  u32 files_count = 0;
   {
     for (u32 i = 1; i < argc; ++i) {
       if (argv[i][0] != '-') {
-        no_files = false;
+        files[files_count++] = argv[i];
         continue;
       }
 
@@ -87,10 +840,58 @@ int main(int argc, char *argv[])
           options.keep = true;
         } else if (!strcmp(argv[i] + 2, "quiet")) {
           options.quiet = true;
+        } else if (!strcmp(argv[i] + 2, "recursive")) {
+          options.recursive = true;
         } else if (!strcmp(argv[i] + 2, "verbose")) {
           options.verbose = true;
         } else if (!strcmp(argv[i] + 2, "version")) {
           options.version = true;
+        } else if (!strcmp(argv[i] + 2, "fast")) {
+          options.level = BCZIP_LEVEL_MIN;
+        } else if (!strcmp(argv[i] + 2, "best")) {
+          options.level = BCZIP_LEVEL_MAX;
+        } else if (!strcmp(argv[i] + 2, "stats")) {
+          options.stats = true;
+        } else if (!strncmp(argv[i] + 2, "window=", 7)) {
+          if (!parse_number(argv[i] + 9, BCZIP_WINDOW_LOG_MIN, BCZIP_WINDOW_LOG_MAX, &options.window_log)) {
+            eprintf(APP_NAME ": invalid window '%s'\n", argv[i] + 9);
+            return 1;
+          }
+        } else if (!strncmp(argv[i] + 2, "block=", 6)) {
+          if (!parse_number(argv[i] + 8, BCZIP_BLOCK_LOG_MIN, BCZIP_BLOCK_LOG_MAX, &options.block_log)) {
+            eprintf(APP_NAME ": invalid block size '%s'\n", argv[i] + 8);
+            return 1;
+          }
+        } else if (!strncmp(argv[i] + 2, "threads=", 8)) {
+          if (!parse_number(argv[i] + 10, 0, BCZIP_THREADS_MAX, &options.threads_count)) {
+            eprintf(APP_NAME ": invalid thread count '%s'\n", argv[i] + 10);
+            return 1;
+          }
+        } else if (!strncmp(argv[i] + 2, "range", 5) && (!argv[i][7] || argv[i][7] == '=')) {
+          // the value is either after '=' or the next argument
+          const char *const value = argv[i][7] ? argv[i] + 8 : argv[++i];
+          if (!value) {
+            eprintf(APP_NAME ": option '--range' requires an argument\n");
+            return 1;
+          }
+
+          if (!parse_range(value, &options.range_start, &options.range_length)) {
+            eprintf(APP_NAME ": invalid range '%s'\n", value);
+            return 1;
+          }
+
+          // a range is decompressed to stdout, the compressed file is kept
+          options.range = true;
+          options.decompress = true;
+          options.stdout = true;
+        } else if (!strcmp(argv[i] + 2, "train")) {
+          options.train = true;
+        } else if (!strncmp(argv[i] + 2, "dict", 4) && (!argv[i][6] || argv[i][6] == '=')) {
+          options.dictionary_path = argv[i][6] ? argv[i] + 7 : argv[++i];
+          if (!options.dictionary_path) {
+            eprintf(APP_NAME ": option '--dict' requires an argument\n");
+            return 1;
+          }
         } else {
           eprintf(APP_NAME ": invalid option '%s'\n", argv[i]);
           return 1;
@@ -111,10 +912,34 @@ int main(int argc, char *argv[])
           options.keep = true;
         } else if (argv[i][j] == 'q') {
           options.quiet = true;
+        } else if (argv[i][j] == 'r') {
+          options.recursive = true;
         } else if (argv[i][j] == 'v') {
           options.verbose = true;
         } else if (argv[i][j] == 'V') {
           options.version = true;
+        } else if (argv[i][j] >= '0' + BCZIP_LEVEL_MIN && argv[i][j] <= '0' + BCZIP_LEVEL_MAX) {
+          options.level = argv[i][j] - '0';
+        } else if (argv[i][j] == 'T') {
+          // the value is either the rest of the argument or the next one
+          const char *const value = argv[i][j + 1] ? argv[i] + j + 1 : argv[++i];
+          if (!value) {
+            eprintf(APP_NAME ": option '-T' requires an argument\n");
+            return 1;
+          }
+
+          if (!parse_number(value, 0, BCZIP_THREADS_MAX, &options.threads_count)) {
+            eprintf(APP_NAME ": invalid thread count '%s'\n", value);
+            return 1;
+          }
+          break;
+        } else if (argv[i][j] == 'o') {
+          options.train_path = argv[i][j + 1] ? argv[i] + j + 1 : argv[++i];
+          if (!options.train_path) {
+            eprintf(APP_NAME ": option '-o' requires an argument\n");
+            return 1;
+          }
+          break;
         } else {
           eprintf(APP_NAME ": invalid option '-%c'\n", argv[i][j]);
           return 1;
@@ -123,6 +948,14 @@ int main(int argc, char *argv[])
     }
   }
 
+  // zero threads stand for one per online processor
+  if (!options.threads_count) {
+    const long processors_count = sysconf(_SC_NPROCESSORS_ONLN);
+    options.threads_count = processors_count < 1 ? 1 : processors_count > BCZIP_THREADS_MAX ? BCZIP_THREADS_MAX : processors_count;
+  }
+
+  const bczip_compress_settings settings = {options.window_log, options.block_log, options.threads_count, options.level};
+
   if (options.help) {
     print_help();
     return 0;
@@ -133,169 +966,112 @@ int main(int argc, char *argv[])
     return 0;
   }
 
-  if (!isatty(fileno(stdin)) && no_files) {
-    FILE *const input_tmp = tmpfile();
-    FILE *const output_tmp = tmpfile();
-
-    i16 ch;
-    while ((ch = getc(stdin)) != EOF) {
-      putc(ch, input_tmp);
-    }
-
-    if (options.decompress) {
-      if (magic_header_valid(input_tmp)) {
-        decompress(input_tmp, output_tmp);
-      } else {
-        if (!options.quiet) { eprintf(APP_NAME ": stdin not in " APP_NAME " format\n"); }
-      }
-    } else {
-      compress(input_tmp, output_tmp);
-    }
-
-    rewind(output_tmp);
-    while ((ch = getc(output_tmp)) != EOF) {
-      putc(ch, stdout);
-    }
-
-    fclose(input_tmp);
-    fclose(output_tmp);
+  if (!files_count && isatty(fileno(stdin))) {
+    print_help();
     return 0;
   }
 
-  if (no_files) {
-    print_help();
-    return 0;
+  if (options.train && (!options.train_path || !files_count)) {
+    eprintf(APP_NAME ": option '--train' requires FILEs and '-o FILE'\n");
+    free(files);
+    return 1;
   }
 
-  for (u32 i = 1; i < argc; ++i) {
-    if (argv[i][0] == '-') { continue; }
+  if (options.dictionary_path && !(options.dictionary = load_dictionary(options.dictionary_path))) {
+    free(files);
+    return 1;
+  }
 
-    FILE *const input = fopen(argv[i], "rb+");
-    if (!input) {
-      if (!options.quiet) { eprintf(APP_NAME ": no such file '%s'\n", argv[i]); }
-      continue;
+  file_list file_paths = {0};
+  for (u32 i = 0; i < files_count; ++i) {
+    struct stat status;
+    if (options.recursive && !stat(files[i], &status) && S_ISDIR(status.st_mode)) {
+      add_directory_files(&file_paths, files[i], options.decompress && !options.train);
+    } else {
+      file_list_add(&file_paths, strdup(files[i]));
     }
+  }
 
-    const u32 input_pathname_length = strlen(argv[i]);
-    u32 output_pathname_length;
-    char *output_pathname;
-    FILE *output;
-
-    if (options.decompress) {
-      if (input_pathname_length < strlen(EXT_NAME) + 2 ||
-          strcmp(argv[i] + input_pathname_length - strlen(EXT_NAME) - 1, "." EXT_NAME)) {
-        if (!options.quiet) { eprintf(APP_NAME ": '%s' has unknown suffix\n", argv[i]); }
-        fclose(input);
-        continue;
-      }
-
-      if (!magic_header_valid(input)) {
-        if (!options.quiet) { eprintf(APP_NAME ": '%s' not in " APP_NAME " format\n", argv[i]); }
-        fclose(input);
-        continue;
-      }
-
-      output_pathname_length = input_pathname_length - strlen(EXT_NAME) - 1;
-      output_pathname = malloc((output_pathname_length + 1) * sizeof(char));
-      memcpy(output_pathname, argv[i], output_pathname_length);
-      output_pathname[output_pathname_length] = '\0';
-
-      if (!options.force && !options.stdout && file_exist(output_pathname)) {
-        printf(APP_NAME ": '%s' already exists; do you want to overwrite (y/N)? ", output_pathname);
-        i16 ch = getchar();
-
-        i16 c = ch;
-        while (c != EOF && c != '\n') {
-          c = getchar();
-        }
-
-        if (tolower(ch) != 'y') {
-          puts("\tnot overwritten");
-          fclose(input);
-          free(output_pathname);
-          continue;
-        }
-      }
-
-      output = options.stdout ? tmpfile() : fopen(output_pathname, "wb+");
-      if (!output) {
-        if (!options.quiet) { eprintf(APP_NAME ": '%s' can't open output stream\n", argv[i]); }
-        fclose(input);
-        free(output_pathname);
-        continue;
-      }
-
-      decompress(input, output);
-    } else {
-      if (input_pathname_length > strlen(EXT_NAME) + 1 &&
-          !strcmp(argv[i] + input_pathname_length - strlen(EXT_NAME) - 1, "." EXT_NAME)) {
-        if (!options.quiet) { eprintf(APP_NAME ": '%s' already has '." EXT_NAME "' suffix\n", argv[i]); }
-        fclose(input);
-        continue;
-      }
+  if (options.train) {
+    const bool trained = train(&options, &file_paths);
+    delete_file_list(&file_paths);
+    free(files);
+    return !trained;
+  }
 
-      output_pathname_length = strlen(argv[i]) + strlen(EXT_NAME) + 1;
-      output_pathname = malloc((output_pathname_length + 1) * sizeof(char));
-      memcpy(output_pathname, argv[i], input_pathname_length + 1);
-      strncat(output_pathname, "." EXT_NAME, strlen(EXT_NAME) + 1);
+  options.batch = file_paths.size > 1;
 
-      if (!options.force && !options.stdout && file_exist(output_pathname)) {
-        printf(APP_NAME ": '%s' already exists; do you want to overwrite (y/N)? ", output_pathname);
-        i16 ch = getchar();
+  // independent files are processed in parallel, a single one gets all the threads for its blocks
+  if (file_paths.size > 1 && options.threads_count > 1) {
+    const u32 workers_count = file_paths.size < options.threads_count ? file_paths.size : options.threads_count;
+    const bool processed = process_files_in_parallel(&options, &settings, &file_paths, workers_count);
 
-        i16 c = ch;
-        while (c != EOF && c != '\n') {
-          c = getchar();
-        }
+    delete_file_list(&file_paths);
+    if (options.dictionary) { bczip_delete_dictionary(options.dictionary); }
+    free(files);
+    return !processed;
+  }
 
-        if (tolower(ch) != 'y') {
-          puts("\tnot overwritten");
-          fclose(input);
-          free(output_pathname);
-          continue;
-        }
-      }
+  bczip_ctx *const ctx = bczip_create_ctx(&settings);
+  bczip_set_dictionary(ctx, options.dictionary);
 
-      output = options.stdout ? tmpfile() : fopen(output_pathname, "wb+");
-      if (!output) {
-        if (!options.quiet) { eprintf(APP_NAME ": '%s' can't open output stream\n", argv[i]); }
-        fclose(input);
-        free(output_pathname);
-        continue;
-      }
+  // stdin is compressed block by block as it arrives, so memory stays bounded by the block size
+  // and output starts before the input ends
+  if (!files_count && !options.decompress) {
+    bczip_compress_file(ctx, stdin, stdout);
+    if (options.stats) { print_compress_stats(ctx, "stdin", stderr); }
+    bczip_delete_ctx(ctx);
+    if (options.dictionary) { bczip_delete_dictionary(options.dictionary); }
+    free(files);
+    return 0;
+  }
 
-      compress(input, output);
+  // decompression streams too, only a range needs to seek in its input
+  if (!files_count && !options.range) {
+    const bool decompressed = bczip_decompress_file(ctx, stdin, stdout);
+    if (!decompressed) {
+      if (!options.quiet) { eprintf(APP_NAME ": stdin not in " APP_NAME " format\n"); }
+    } else if (options.stats) {
+      print_decompress_stats(ctx, "stdin", stderr);
     }
 
-    if (options.verbose && !options.stdout) {
-      fseek(input, 0, SEEK_END);
-      fseek(output, 0, SEEK_END);
-
-      double diff;
-      if (options.decompress) {
-        diff = (double)ftell(input) / ftell(output);
-      } else {
-        diff = (double)ftell(output) / ftell(input);
-      }
-
-      printf(APP_NAME ": '%s'\t%3.1f%% replaced with '%s'\n", argv[i], diff * 100, output_pathname);
-    }
+    bczip_delete_ctx(ctx);
+    if (options.dictionary) { bczip_delete_dictionary(options.dictionary); }
+    free(files);
+    return !decompressed;
+  }
 
-    if (options.stdout) {
-      rewind(output);
+  if (!files_count) {
+    FILE *const input_tmp = tmpfile();
+    copy_fd(fileno(stdin), fileno(input_tmp));
 
-      i16 ch;
-      while ((ch = getc(output)) != EOF) {
-        putc(ch, stdout);
+    bool decompressed = false;
+    if (!magic_header_valid(input_tmp)) {
+      if (!options.quiet) { eprintf(APP_NAME ": stdin not in " APP_NAME " format\n"); }
+    } else if (dictionary_given(&options, input_tmp, "stdin", stderr)) {
+      decompressed = bczip_decompress_range(ctx, input_tmp, stdout, options.range_start, options.range_length);
+      if (!decompressed) {
+        if (!options.quiet) { eprintf(APP_NAME ": stdin not in " APP_NAME " format\n"); }
+      } else if (options.stats) {
+        print_decompress_stats(ctx, "stdin", stderr);
       }
     }
 
-    fclose(input);
-    fclose(output);
-    free(output_pathname);
+    fclose(input_tmp);
+    bczip_delete_ctx(ctx);
+    if (options.dictionary) { bczip_delete_dictionary(options.dictionary); }
+    free(files);
+    return !decompressed;
+  }
 
-    if (!options.keep && !options.stdout) { remove(argv[i]); }
+  bool processed = true;
+  for (u32 i = 0; i < file_paths.size; ++i) {
+    processed &= process_file(&options, ctx, file_paths.paths[i], stdout, stderr, stdout, true);
   }
 
-  return 0;
+  delete_file_list(&file_paths);
+  bczip_delete_ctx(ctx);
+  if (options.dictionary) { bczip_delete_dictionary(options.dictionary); }
+  free(files);
+  return !processed;
 }
@@ -0,0 +1,202 @@
+#include "types.h"
+
+#if defined(__x86_64__) || (defined(__i386__) && defined(__SSE2__))
+#define RUN_LENGTH_X86
+#include <immintrin.h>
+#elif defined(__aarch64__)
+#define RUN_LENGTH_NEON
+#include <arm_neon.h>
+#endif
+
+// every run is the number of leading bytes of 'data' that pass a test against the byte before
+// them, so data[-1] has to be readable; the test compares whole vectors of bytes at once when
+// the processor can, the result is the same as the scalar one either way
+enum run_kind {
+  RK_STEP,         // the byte before plus 'argument'
+  RK_ROTATE_LEFT,  // the byte before rotated left by one bit
+  RK_ROTATE_RIGHT, // the byte before rotated right by one bit
+};
+
+// ================================================================================ external functions
+
+u32 run_length_step(const u8 *data, u32 length, u8 step);
+u32 run_length_rotate_left(const u8 *data, u32 length);
+u32 run_length_rotate_right(const u8 *data, u32 length);
+
+// ================================================================================ internal functions
+
+static u32 run_length(const u8 *data, u32 length, enum run_kind kind, u8 argument);
+static bool run_matches(u8 previous, u8 current, enum run_kind kind, u8 argument);
+static u32 run_length_scalar(const u8 *data, u32 length, enum run_kind kind, u8 argument);
+
+#ifdef RUN_LENGTH_X86
+static __m128i run_matches_sse2(__m128i previous, __m128i current, enum run_kind kind, u8 argument);
+static u32 run_length_sse2(const u8 *data, u32 length, enum run_kind kind, u8 argument);
+static __m256i run_matches_avx2(__m256i previous, __m256i current, enum run_kind kind, u8 argument);
+static u32 run_length_avx2(const u8 *data, u32 length, enum run_kind kind, u8 argument);
+#endif
+
+#ifdef RUN_LENGTH_NEON
+static uint8x16_t run_matches_neon(uint8x16_t previous, uint8x16_t current, enum run_kind kind, u8 argument);
+static u32 run_length_neon(const u8 *data, u32 length, enum run_kind kind, u8 argument);
+#endif
+
+// ================================================================================ definitions
+
+u32 run_length_step(const u8 *data, u32 length, u8 step)
+{
+  return run_length(data, length, RK_STEP, step);
+}
+
+u32 run_length_rotate_left(const u8 *data, u32 length)
+{
+  return run_length(data, length, RK_ROTATE_LEFT, 0);
+}
+
+u32 run_length_rotate_right(const u8 *data, u32 length)
+{
+  return run_length(data, length, RK_ROTATE_RIGHT, 0);
+}
+
+// the processor is asked on every call, it's a load of what libgcc found out at startup
+u32 run_length(const u8 *data, u32 length, enum run_kind kind, u8 argument)
+{
+#if defined(RUN_LENGTH_X86)
+  if (length >= 32 && __builtin_cpu_supports("avx2")) { return run_length_avx2(data, length, kind, argument); }
+  return run_length_sse2(data, length, kind, argument);
+#elif defined(RUN_LENGTH_NEON)
+  return run_length_neon(data, length, kind, argument);
+#else
+  return run_length_scalar(data, length, kind, argument);
+#endif
+}
+
+bool run_matches(u8 previous, u8 current, enum run_kind kind, u8 argument)
+{
+  switch (kind) {
+  case RK_STEP:
+    return (u8)(current - previous) == argument;
+  case RK_ROTATE_LEFT:
+    return current == (u8)((previous << 1) | (previous >> 7));
+  case RK_ROTATE_RIGHT:
+    return current == (u8)((previous >> 1) | (previous << 7));
+  }
+
+  return false;
+}
+
+u32 run_length_scalar(const u8 *data, u32 length, enum run_kind kind, u8 argument)
+{
+  u32 i = 0;
+  while (i < length && run_matches(*(data + i - 1), data[i], kind, argument)) {
+    i++;
+  }
+
+  return i;
+}
+
+#ifdef RUN_LENGTH_X86
+
+__m128i run_matches_sse2(__m128i previous, __m128i current, enum run_kind kind, u8 argument)
+{
+  switch (kind) {
+  case RK_STEP:
+    return _mm_cmpeq_epi8(_mm_sub_epi8(current, previous), _mm_set1_epi8(argument));
+
+  case RK_ROTATE_LEFT: {
+    const __m128i rotated = _mm_or_si128(_mm_add_epi8(previous, previous),
+                                         _mm_and_si128(_mm_srli_epi16(previous, 7), _mm_set1_epi8(0x01)));
+    return _mm_cmpeq_epi8(current, rotated);
+  }
+
+  case RK_ROTATE_RIGHT: {
+    const __m128i rotated = _mm_or_si128(_mm_and_si128(_mm_srli_epi16(previous, 1), _mm_set1_epi8(0x7F)),
+                                         _mm_and_si128(_mm_slli_epi16(previous, 7), _mm_set1_epi8((char)0x80)));
+    return _mm_cmpeq_epi8(current, rotated);
+  }
+  }
+
+  return _mm_setzero_si128();
+}
+
+u32 run_length_sse2(const u8 *data, u32 length, enum run_kind kind, u8 argument)
+{
+  u32 i = 0;
+  for (; i + 16 <= length; i += 16) {
+    const __m128i previous = _mm_loadu_si128((const __m128i *)(data + i - 1));
+    const __m128i current = _mm_loadu_si128((const __m128i *)(data + i));
+
+    const u32 mismatches = ~_mm_movemask_epi8(run_matches_sse2(previous, current, kind, argument)) & 0xFFFF;
+    if (mismatches) { return i + __builtin_ctz(mismatches); }
+  }
+
+  return i + run_length_scalar(data + i, length - i, kind, argument);
+}
+
+__attribute__((target("avx2"))) __m256i run_matches_avx2(__m256i previous, __m256i current, enum run_kind kind, u8 argument)
+{
+  switch (kind) {
+  case RK_STEP:
+    return _mm256_cmpeq_epi8(_mm256_sub_epi8(current, previous), _mm256_set1_epi8(argument));
+
+  case RK_ROTATE_LEFT: {
+    const __m256i rotated = _mm256_or_si256(_mm256_add_epi8(previous, previous),
+                                            _mm256_and_si256(_mm256_srli_epi16(previous, 7), _mm256_set1_epi8(0x01)));
+    return _mm256_cmpeq_epi8(current, rotated);
+  }
+
+  case RK_ROTATE_RIGHT: {
+    const __m256i rotated = _mm256_or_si256(_mm256_and_si256(_mm256_srli_epi16(previous, 1), _mm256_set1_epi8(0x7F)),
+                                            _mm256_and_si256(_mm256_slli_epi16(previous, 7), _mm256_set1_epi8((char)0x80)));
+    return _mm256_cmpeq_epi8(current, rotated);
+  }
+  }
+
+  return _mm256_setzero_si256();
+}
+
+__attribute__((target("avx2"))) u32 run_length_avx2(const u8 *data, u32 length, enum run_kind kind, u8 argument)
+{
+  u32 i = 0;
+  for (; i + 32 <= length; i += 32) {
+    const __m256i previous = _mm256_loadu_si256((const __m256i *)(data + i - 1));
+    const __m256i current = _mm256_loadu_si256((const __m256i *)(data + i));
+
+    const u32 mismatches = ~(u32)_mm256_movemask_epi8(run_matches_avx2(previous, current, kind, argument));
+    if (mismatches) { return i + __builtin_ctz(mismatches); }
+  }
+
+  return i + run_length_sse2(data + i, length - i, kind, argument);
+}
+
+#endif
+
+#ifdef RUN_LENGTH_NEON
+
+uint8x16_t run_matches_neon(uint8x16_t previous, uint8x16_t current, enum run_kind kind, u8 argument)
+{
+  switch (kind) {
+  case RK_STEP:
+    return vceqq_u8(vsubq_u8(current, previous), vdupq_n_u8(argument));
+  case RK_ROTATE_LEFT:
+    return vceqq_u8(current, vorrq_u8(vshlq_n_u8(previous, 1), vshrq_n_u8(previous, 7)));
+  case RK_ROTATE_RIGHT:
+    return vceqq_u8(current, vorrq_u8(vshrq_n_u8(previous, 1), vshlq_n_u8(previous, 7)));
+  }
+
+  return vdupq_n_u8(0);
+}
+
+// NEON has no movemask, a vector with a mismatch is left for the scalar loop to pinpoint
+u32 run_length_neon(const u8 *data, u32 length, enum run_kind kind, u8 argument)
+{
+  u32 i = 0;
+  for (; i + 16 <= length; i += 16) {
+    const uint8x16_t matches = run_matches_neon(vld1q_u8(data + i - 1), vld1q_u8(data + i), kind, argument);
+    if (vminvq_u8(matches) != 0xFF) { break; }
+  }
+
+  return i + run_length_scalar(data + i, length - i, kind, argument);
+}
+
+#endif
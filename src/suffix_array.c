@@ -0,0 +1,222 @@
+#include "types.h"
+#include <stdlib.h>
+#include <string.h>
+
+// ================================================================================ external functions
+
+void create_suffix_array(const u8 *text, u32 length, u32 *suffix_array);
+void create_lcp_array(const u8 *text, u32 length, const u32 *suffix_array, u32 *lcp_array);
+
+// ================================================================================ internal functions
+
+static u32 symbol(const void *text, u32 length, bool wide, u32 i);
+static bool is_lms(const u8 *types, u32 i);
+
+static void fill_buckets(const void *text, u32 length, bool wide, u32 alphabet_size, u32 *buckets, bool end);
+static void induce_l_types(const void *text, u32 length, bool wide, u32 alphabet_size,
+                           const u8 *types, u32 *buckets, u32 *suffix_array);
+static void induce_s_types(const void *text, u32 length, bool wide, u32 alphabet_size,
+                           const u8 *types, u32 *buckets, u32 *suffix_array);
+
+static void sais(const void *text, u32 length, bool wide, u32 alphabet_size, u32 *suffix_array);
+
+// ================================================================================ internal variables
+
+static const u32 EMPTY = 0xFFFFFFFF;
+
+// ================================================================================ definitions
+
+// The top level text is a byte string with a virtual sentinel appended: every byte is
+// shifted up by one and position 'length - 1' reads as the unique smallest symbol 0.
+// Recursion levels work on 'wide' u32 names which already end with their own sentinel.
+u32 symbol(const void *text, u32 length, bool wide, u32 i)
+{
+  if (wide) { return ((const u32 *)text)[i]; }
+  return i == length - 1 ? 0 : ((const u8 *)text)[i] + 1;
+}
+
+bool is_lms(const u8 *types, u32 i)
+{
+  return i && types[i] && !types[i - 1];
+}
+
+void fill_buckets(const void *text, u32 length, bool wide, u32 alphabet_size, u32 *buckets, bool end)
+{
+  memset(buckets, 0, alphabet_size * sizeof(u32));
+  for (u32 i = 0; i < length; ++i) {
+    buckets[symbol(text, length, wide, i)]++;
+  }
+
+  u32 sum = 0;
+  for (u32 i = 0; i < alphabet_size; ++i) {
+    sum += buckets[i];
+    buckets[i] = end ? sum : sum - buckets[i];
+  }
+}
+
+void induce_l_types(const void *text, u32 length, bool wide, u32 alphabet_size,
+                    const u8 *types, u32 *buckets, u32 *suffix_array)
+{
+  fill_buckets(text, length, wide, alphabet_size, buckets, false);
+
+  for (u32 i = 0; i < length; ++i) {
+    if (suffix_array[i] == EMPTY || !suffix_array[i]) { continue; }
+
+    const u32 j = suffix_array[i] - 1;
+    if (!types[j]) { suffix_array[buckets[symbol(text, length, wide, j)]++] = j; }
+  }
+}
+
+void induce_s_types(const void *text, u32 length, bool wide, u32 alphabet_size,
+                    const u8 *types, u32 *buckets, u32 *suffix_array)
+{
+  fill_buckets(text, length, wide, alphabet_size, buckets, true);
+
+  for (u32 i = length; i-- > 0;) {
+    if (suffix_array[i] == EMPTY || !suffix_array[i]) { continue; }
+
+    const u32 j = suffix_array[i] - 1;
+    if (types[j]) { suffix_array[--buckets[symbol(text, length, wide, j)]] = j; }
+  }
+}
+
+// SA-IS (Nong, Zhang & Chan): sorts LMS substrings by induction, names them, sorts the
+// reduced string recursively when names aren't unique and induces the final order from it.
+void sais(const void *text, u32 length, bool wide, u32 alphabet_size, u32 *suffix_array)
+{
+  if (length == 1) {
+    suffix_array[0] = 0;
+    return;
+  }
+
+  // types[i] is 1 for S-type suffixes and 0 for L-type ones
+  u8 *const types = malloc(length * sizeof(u8));
+  types[length - 1] = 1;
+  types[length - 2] = 0;
+
+  for (u32 i = length - 1; i-- > 1;) {
+    const u32 a = symbol(text, length, wide, i - 1);
+    const u32 b = symbol(text, length, wide, i);
+    types[i - 1] = a < b || (a == b && types[i]);
+  }
+
+  u32 *const buckets = malloc(alphabet_size * sizeof(u32));
+
+  fill_buckets(text, length, wide, alphabet_size, buckets, true);
+  memset(suffix_array, 0xFF, length * sizeof(u32));
+  for (u32 i = 1; i < length; ++i) {
+    if (is_lms(types, i)) { suffix_array[--buckets[symbol(text, length, wide, i)]] = i; }
+  }
+
+  induce_l_types(text, length, wide, alphabet_size, types, buckets, suffix_array);
+  induce_s_types(text, length, wide, alphabet_size, types, buckets, suffix_array);
+
+  u32 lms_count = 0;
+  for (u32 i = 0; i < length; ++i) {
+    if (is_lms(types, suffix_array[i])) { suffix_array[lms_count++] = suffix_array[i]; }
+  }
+
+  memset(suffix_array + lms_count, 0xFF, (length - lms_count) * sizeof(u32));
+
+  u32 names_count = 0;
+  {
+    u32 previous = EMPTY;
+    for (u32 i = 0; i < lms_count; ++i) {
+      const u32 position = suffix_array[i];
+
+      bool different = previous == EMPTY;
+      for (u32 d = 0; !different; ++d) {
+        if (symbol(text, length, wide, position + d) != symbol(text, length, wide, previous + d) ||
+            types[position + d] != types[previous + d]) {
+          different = true;
+        } else if (d && (is_lms(types, position + d) || is_lms(types, previous + d))) {
+          break;
+        }
+      }
+
+      if (different) {
+        names_count++;
+        previous = position;
+      }
+
+      suffix_array[lms_count + position / 2] = names_count - 1;
+    }
+
+    for (u32 i = length, j = length; i-- > lms_count;) {
+      if (suffix_array[i] != EMPTY) { suffix_array[--j] = suffix_array[i]; }
+    }
+  }
+
+  u32 *const reduced_suffix_array = suffix_array;
+  u32 *const reduced_text = suffix_array + length - lms_count;
+
+  if (names_count < lms_count) {
+    sais(reduced_text, lms_count, true, names_count, reduced_suffix_array);
+  } else {
+    for (u32 i = 0; i < lms_count; ++i) {
+      reduced_suffix_array[reduced_text[i]] = i;
+    }
+  }
+
+  for (u32 i = 1, j = 0; i < length; ++i) {
+    if (is_lms(types, i)) { reduced_text[j++] = i; }
+  }
+
+  for (u32 i = 0; i < lms_count; ++i) {
+    reduced_suffix_array[i] = reduced_text[reduced_suffix_array[i]];
+  }
+
+  memset(suffix_array + lms_count, 0xFF, (length - lms_count) * sizeof(u32));
+
+  fill_buckets(text, length, wide, alphabet_size, buckets, true);
+  for (u32 i = lms_count; i-- > 0;) {
+    const u32 j = suffix_array[i];
+    suffix_array[i] = EMPTY;
+    suffix_array[--buckets[symbol(text, length, wide, j)]] = j;
+  }
+
+  induce_l_types(text, length, wide, alphabet_size, types, buckets, suffix_array);
+  induce_s_types(text, length, wide, alphabet_size, types, buckets, suffix_array);
+
+  free(buckets);
+  free(types);
+}
+
+// suffix_array must have room for 'length + 1' items: the sentinel suffix always sorts
+// first, so it's sorted in place and dropped from the front afterwards
+void create_suffix_array(const u8 *text, u32 length, u32 *suffix_array)
+{
+  sais(text, length + 1, false, 257, suffix_array);
+  memmove(suffix_array, suffix_array + 1, length * sizeof(u32));
+}
+
+// Kasai et al.: lcp_array[i] is the length of the common prefix of suffixes i - 1 and i
+void create_lcp_array(const u8 *text, u32 length, const u32 *suffix_array, u32 *lcp_array)
+{
+  if (!length) { return; }
+
+  u32 *const rank = malloc(length * sizeof(u32));
+  for (u32 i = 0; i < length; ++i) {
+    rank[suffix_array[i]] = i;
+  }
+
+  lcp_array[0] = 0;
+
+  u32 h = 0;
+  for (u32 i = 0; i < length; ++i) {
+    if (!rank[i]) {
+      h = 0;
+      continue;
+    }
+
+    const u32 j = suffix_array[rank[i] - 1];
+    while (i + h < length && j + h < length && text[i + h] == text[j + h]) {
+      h++;
+    }
+
+    lcp_array[rank[i]] = h;
+    if (h) { h--; }
+  }
+
+  free(rank);
+}
@@ -0,0 +1,146 @@
+#include "types.h"
+#include <pthread.h>
+#include <stdlib.h>
+
+typedef struct thread_pool_task_t {
+  void (*function)(void *);
+  void *argument;
+} thread_pool_task;
+
+// tasks are kept in a ring buffer that grows when it's full; a pool without threads runs
+// every task right away in the submitting thread
+typedef struct thread_pool_t {
+  pthread_t *threads;
+  u32 threads_count;
+
+  thread_pool_task *tasks;
+  u32 tasks_capacity;
+  u32 tasks_head;
+  u32 tasks_size;
+  u32 running_count;
+  bool stopping;
+
+  pthread_mutex_t mutex;
+  pthread_cond_t task_submitted;
+  pthread_cond_t tasks_finished;
+} thread_pool;
+
+// ================================================================================ external functions
+
+thread_pool *create_thread_pool(u32 threads_count);
+void thread_pool_submit(thread_pool *pool, void (*function)(void *), void *argument);
+void thread_pool_wait(thread_pool *pool);
+void delete_thread_pool(thread_pool *pool);
+
+// ================================================================================ internal functions
+
+static void *thread_pool_worker(void *pool_pointer);
+
+// ================================================================================ definitions
+
+thread_pool *create_thread_pool(u32 threads_count)
+{
+  thread_pool *const pool = calloc(1, sizeof(thread_pool));
+  if (threads_count < 2) { return pool; }
+
+  pool->tasks_capacity = threads_count * 2;
+  pool->tasks = malloc(pool->tasks_capacity * sizeof(thread_pool_task));
+
+  pthread_mutex_init(&pool->mutex, NULL);
+  pthread_cond_init(&pool->task_submitted, NULL);
+  pthread_cond_init(&pool->tasks_finished, NULL);
+
+  pool->threads = malloc(threads_count * sizeof(pthread_t));
+  for (; pool->threads_count < threads_count; ++pool->threads_count) {
+    if (pthread_create(pool->threads + pool->threads_count, NULL, thread_pool_worker, pool)) { break; }
+  }
+
+  return pool;
+}
+
+void thread_pool_submit(thread_pool *pool, void (*function)(void *), void *argument)
+{
+  if (!pool->threads_count) {
+    function(argument);
+    return;
+  }
+
+  pthread_mutex_lock(&pool->mutex);
+
+  if (pool->tasks_size == pool->tasks_capacity) {
+    pool->tasks = realloc(pool->tasks, pool->tasks_capacity * 2 * sizeof(thread_pool_task));
+    for (u32 i = 0; i < pool->tasks_head; ++i) {
+      pool->tasks[pool->tasks_capacity + i] = pool->tasks[i];
+    }
+
+    pool->tasks_capacity *= 2;
+  }
+
+  pool->tasks[(pool->tasks_head + pool->tasks_size++) % pool->tasks_capacity] = (thread_pool_task){function, argument};
+
+  pthread_cond_signal(&pool->task_submitted);
+  pthread_mutex_unlock(&pool->mutex);
+}
+
+void thread_pool_wait(thread_pool *pool)
+{
+  if (!pool->threads_count) { return; }
+
+  pthread_mutex_lock(&pool->mutex);
+  while (pool->tasks_size || pool->running_count) {
+    pthread_cond_wait(&pool->tasks_finished, &pool->mutex);
+  }
+
+  pthread_mutex_unlock(&pool->mutex);
+}
+
+void delete_thread_pool(thread_pool *pool)
+{
+  if (pool->threads_count) {
+    pthread_mutex_lock(&pool->mutex);
+    pool->stopping = true;
+    pthread_cond_broadcast(&pool->task_submitted);
+    pthread_mutex_unlock(&pool->mutex);
+
+    for (u32 i = 0; i < pool->threads_count; ++i) {
+      pthread_join(pool->threads[i], NULL);
+    }
+
+    pthread_cond_destroy(&pool->tasks_finished);
+    pthread_cond_destroy(&pool->task_submitted);
+    pthread_mutex_destroy(&pool->mutex);
+  }
+
+  free(pool->threads);
+  free(pool->tasks);
+  free(pool);
+}
+
+void *thread_pool_worker(void *pool_pointer)
+{
+  thread_pool *const pool = pool_pointer;
+  pthread_mutex_lock(&pool->mutex);
+
+  for (;;) {
+    while (!pool->tasks_size && !pool->stopping) {
+      pthread_cond_wait(&pool->task_submitted, &pool->mutex);
+    }
+
+    if (!pool->tasks_size) { break; }
+
+    const thread_pool_task task = pool->tasks[pool->tasks_head];
+    pool->tasks_head = (pool->tasks_head + 1) % pool->tasks_capacity;
+    pool->tasks_size--;
+    pool->running_count++;
+
+    pthread_mutex_unlock(&pool->mutex);
+    task.function(task.argument);
+    pthread_mutex_lock(&pool->mutex);
+
+    pool->running_count--;
+    if (!pool->tasks_size && !pool->running_count) { pthread_cond_broadcast(&pool->tasks_finished); }
+  }
+
+  pthread_mutex_unlock(&pool->mutex);
+  return NULL;
+}
@@ -0,0 +1,96 @@
+#include "types.h"
+#include <pthread.h>
+#include <stdlib.h>
+
+typedef struct work_deque_t {
+  u32 *tasks;
+  u32 head;
+  u32 tail;
+  pthread_mutex_t mutex;
+} work_deque;
+
+// Tasks are dealt to the workers' deques round robin, in the order they're given. A worker
+// takes its own tasks from the front and, once it has none left, steals from the back of the
+// others', so a worker stuck on a long task has its remaining ones done by the idle workers.
+typedef struct work_queue_t {
+  work_deque *deques;
+  u32 workers_count;
+} work_queue;
+
+// ================================================================================ external functions
+
+work_queue *create_work_queue(u32 workers_count, const u32 *tasks, u32 tasks_count);
+bool work_queue_take(work_queue *queue, u32 worker, u32 *task);
+void delete_work_queue(work_queue *queue);
+
+// ================================================================================ internal functions
+
+static bool work_deque_pop_front(work_deque *deque, u32 *task);
+static bool work_deque_pop_back(work_deque *deque, u32 *task);
+
+// ================================================================================ definitions
+
+work_queue *create_work_queue(u32 workers_count, const u32 *tasks, u32 tasks_count)
+{
+  work_queue *const queue = malloc(sizeof(work_queue));
+  queue->workers_count = workers_count;
+  queue->deques = malloc(workers_count * sizeof(work_deque));
+
+  for (u32 i = 0; i < workers_count; ++i) {
+    work_deque *const deque = queue->deques + i;
+    deque->tasks = malloc((tasks_count / workers_count + 1) * sizeof(u32));
+    deque->head = 0;
+    deque->tail = 0;
+    pthread_mutex_init(&deque->mutex, NULL);
+  }
+
+  for (u32 i = 0; i < tasks_count; ++i) {
+    work_deque *const deque = queue->deques + i % workers_count;
+    deque->tasks[deque->tail++] = tasks[i];
+  }
+
+  return queue;
+}
+
+// false once every deque is empty
+bool work_queue_take(work_queue *queue, u32 worker, u32 *task)
+{
+  if (work_deque_pop_front(queue->deques + worker, task)) { return true; }
+
+  for (u32 i = 1; i < queue->workers_count; ++i) {
+    if (work_deque_pop_back(queue->deques + (worker + i) % queue->workers_count, task)) { return true; }
+  }
+
+  return false;
+}
+
+void delete_work_queue(work_queue *queue)
+{
+  for (u32 i = 0; i < queue->workers_count; ++i) {
+    pthread_mutex_destroy(&queue->deques[i].mutex);
+    free(queue->deques[i].tasks);
+  }
+
+  free(queue->deques);
+  free(queue);
+}
+
+bool work_deque_pop_front(work_deque *deque, u32 *task)
+{
+  pthread_mutex_lock(&deque->mutex);
+  const bool taken = deque->head < deque->tail;
+  if (taken) { *task = deque->tasks[deque->head++]; }
+  pthread_mutex_unlock(&deque->mutex);
+
+  return taken;
+}
+
+bool work_deque_pop_back(work_deque *deque, u32 *task)
+{
+  pthread_mutex_lock(&deque->mutex);
+  const bool taken = deque->head < deque->tail;
+  if (taken) { *task = deque->tasks[--deque->tail]; }
+  pthread_mutex_unlock(&deque->mutex);
+
+  return taken;
+}
@@ -17,16 +17,31 @@ class CompressTest < Test::Unit::TestCase
     assert_equal(MAGIC_HEADER, (fb << 8) + (sb & 0xF))
   end
 
+  # every word repeats, so the items of the dictionary pay for themselves
+  def test_repeated_words_use_dictionary
+    random = Random.new(1)
+    words = Array.new(300) { Array.new(4 + random.rand(8)) { (97 + random.rand(26)).chr }.join }
+    data = Array.new(8000) { words[random.rand(words.size)] }.join(' ')
+
+    compressed, = Open3.capture2("#{EXEC} -9", stdin_data: data, binmode: true)
+    assert(compressed.unpack1('@1v') >> 4 > 0)
+
+    out, err, stat = Open3.capture3("#{EXEC} -d --stats", stdin_data: compressed, binmode: true)
+    assert(stat.success?)
+    assert(err[/^  dictionary +\d+ +(\d+)/, 1].to_i > 0)
+    assert_equal(data, out)
+  end
+
   def test_no_such_file_1
     out, err, stat = Open3.capture3("#{EXEC} foo.txt")
-    assert(stat.success?)
+    assert_equal(1, stat.exitstatus)
     assert(out.empty?)
     assert_equal("#{APP_NAME}: no such file 'foo.txt'\n", err)
   end
 
   def test_no_such_file_2
     out, err, stat = Open3.capture3("#{EXEC} foo.txt bar.txt")
-    assert(stat.success?)
+    assert_equal(1, stat.exitstatus)
     assert(out.empty?)
     assert_equal("#{APP_NAME}: no such file 'foo.txt'\n" \
                  "#{APP_NAME}: no such file 'bar.txt'\n", err)
@@ -35,7 +50,7 @@ class CompressTest < Test::Unit::TestCase
   def test_already_has_suffix_1
     tmp = Tempfile.new(['foo', '.' + EXT_NAME]).tap(&:close).path
     out, err, stat = Open3.capture3("#{EXEC} #{tmp}")
-    assert(stat.success?)
+    assert_equal(1, stat.exitstatus)
     assert(out.empty?)
     assert_equal("#{APP_NAME}: '#{tmp}' already has '.#{EXT_NAME}' suffix\n", err)
   end
@@ -43,7 +58,7 @@ class CompressTest < Test::Unit::TestCase
   def test_already_has_suffix_2
     tmp = Tempfile.new(['foo', '.' + EXT_NAME]).tap(&:close).path
     out, err, stat = Open3.capture3("#{EXEC} #{tmp} bar.txt")
-    assert(stat.success?)
+    assert_equal(1, stat.exitstatus)
     assert(out.empty?)
     assert_equal("#{APP_NAME}: '#{tmp}' already has '.#{EXT_NAME}' suffix\n" \
                  "#{APP_NAME}: no such file 'bar.txt'\n", err)
@@ -1,6 +1,7 @@
 # frozen_string_literal: true
 
 require_relative 'global'
+require 'tmpdir'
 
 class DecompressTest < Test::Unit::TestCase
   def test_decompress
@@ -18,10 +19,55 @@ class DecompressTest < Test::Unit::TestCase
     assert_equal('Hello world!', File.read(tmp))
   end
 
+  def test_decompress_repeated_records
+    data = Array.new(500) { |i| "#{i},#{i * 2},#{i * 7 % 50},name#{i % 13}\n" }.join +
+           "\x10\x11\x19\x20\x22" + 'ab' * 300
+    tmp = Tempfile.new.tap { |x| x.write(data) }.tap(&:close).path
+
+    `#{EXEC} #{tmp}`
+    out, err, stat = Open3.capture3("#{EXEC} --decompress #{tmp}.#{EXT_NAME}")
+    assert(stat.success?)
+    assert(out.empty?)
+    assert(err.empty?)
+
+    assert_equal(data.b, File.binread(tmp))
+  end
+
+  def test_decompress_version_1
+    data = "\xBC\x19\x00\x0C\x00Hello world!\x07\x00\x00\x20\xB4\x07\x00"
+    tmp = Tempfile.new(['foo', '.' + EXT_NAME]).tap { |x| x.binmode.write(data) }.tap(&:close).path
+
+    out, err, stat = Open3.capture3("#{EXEC} -dc #{tmp}")
+    assert(stat.success?)
+    assert(err.empty?)
+    assert_equal('Hello world! Hello world! Hello world!', out)
+  end
+
+  # runs and repetitions of every period are copied a word or a period at a time
+  def test_decompress_runs_and_repetitions
+    random = Random.new(3)
+    data = (1..40).map { |period| random.bytes(period) * (2000 / period) + "\0" * random.rand(5000) }.join
+    compressed, = Open3.capture2(EXEC, stdin_data: data, binmode: true)
+
+    out, err, stat = Open3.capture3("#{EXEC} -d", stdin_data: compressed, binmode: true)
+    assert(stat.success?)
+    assert(err.empty?)
+    assert_equal(data, out)
+  end
+
+  # "Hello", then a back-reference to before the start of the stream, which ends it as corrupted
+  def test_decompress_corrupted_back_reference
+    data = "\xBC\x0A\x00\x14\x40Hello\xF7\xFF\x00\x64\x40world"
+    out, err, stat = Open3.capture3("#{EXEC} -d", stdin_data: data, binmode: true)
+    assert_equal(1, stat.exitstatus)
+    assert_equal("#{APP_NAME}: stdin not in #{APP_NAME} format\n", err)
+    assert_equal('Hello', out)
+  end
+
   def test_unknown_suffix
     tmp = Tempfile.new.tap { |x| x.write('Hello world!') }.tap(&:close).path
     out, err, stat = Open3.capture3("#{EXEC} -d #{tmp}")
-    assert(stat.success?)
+    assert_equal(1, stat.exitstatus)
     assert(out.empty?)
     assert_equal("#{APP_NAME}: '#{tmp}' has unknown suffix\n", err)
   end
@@ -29,7 +75,7 @@ class DecompressTest < Test::Unit::TestCase
   def test_not_in_app_format_empty_file
     tmp = Tempfile.new(['foo', '.' + EXT_NAME]).tap(&:close).path
     out, err, stat = Open3.capture3("#{EXEC} --decompress #{tmp}")
-    assert(stat.success?)
+    assert_equal(1, stat.exitstatus)
     assert(out.empty?)
     assert_equal("#{APP_NAME}: '#{tmp}' not in #{APP_NAME} format\n", err)
   end
@@ -37,8 +83,70 @@ class DecompressTest < Test::Unit::TestCase
   def test_not_in_app_format_filled_file
     tmp = Tempfile.new(['foo', '.' + EXT_NAME]).tap { |x| x.write('Hi') }.tap(&:close).path
     out, err, stat = Open3.capture3("#{EXEC} --decompress #{tmp}")
-    assert(stat.success?)
+    assert_equal(1, stat.exitstatus)
     assert(out.empty?)
     assert_equal("#{APP_NAME}: '#{tmp}' not in #{APP_NAME} format\n", err)
   end
+
+  # the input is kept and nothing is written when the data of the stream is corrupted
+  def test_corrupted_file
+    data = Array.new(5000) { |i| "#{i},#{i * 7 % 1000},name#{i % 13}\n" }.join
+    compressed, = Open3.capture2(EXEC, stdin_data: data, binmode: true)
+    40.times { |i| compressed.setbyte(compressed.size / 3 + i, compressed.getbyte(compressed.size / 3 + i) ^ 0x5A) }
+
+    Dir.mktmpdir do |dir|
+      File.binwrite("#{dir}/victim.#{EXT_NAME}", compressed)
+      out, err, stat = Open3.capture3("#{EXEC} -d #{dir}/victim.#{EXT_NAME}")
+      assert_false(stat.success?)
+      assert(out.empty?)
+      assert_equal("#{APP_NAME}: '#{dir}/victim.#{EXT_NAME}' not in #{APP_NAME} format\n", err)
+      assert_equal(compressed, File.binread("#{dir}/victim.#{EXT_NAME}"))
+      assert_false File.exist?("#{dir}/victim")
+    end
+  end
+
+  # no level writes segments anymore, streams that have them are still decoded: an offset
+  # segment of 0x30 and a jumping one from 0x40 with two pairs of nibbles each
+  def test_decompress_segments
+    compressed = "\xBC\x0A\x00\x14\x3E\x01\x12\x34\x4F\x01\x88\x7F".b
+
+    out, err, stat = Open3.capture3("#{EXEC} -d", stdin_data: compressed, binmode: true)
+    assert(stat.success?)
+    assert(err.empty?)
+    assert_equal('1234ABAI', out)
+  end
+
+  # a stream without a dictionary of its own whose token refers to its item 5
+  def test_dictionary_index_out_of_range
+    Dir.mktmpdir do |dir|
+      compressed = "\xBC\x0A\x00\x14\x00H\x57\x00\x00!".b
+      File.binwrite("#{dir}/victim.#{EXT_NAME}", compressed)
+
+      out, err, stat = Open3.capture3("#{EXEC} -d #{dir}/victim.#{EXT_NAME}")
+      assert_equal(1, stat.exitstatus)
+      assert(out.empty?)
+      assert_equal("#{APP_NAME}: '#{dir}/victim.#{EXT_NAME}' not in #{APP_NAME} format\n", err)
+      assert_false File.exist?("#{dir}/victim")
+    end
+  end
+
+  # the other files are still decompressed, but the exit status tells one of them wasn't
+  def test_bad_file_among_others
+    Dir.mktmpdir do |dir|
+      %w[1 4].each do |count|
+        File.write("#{dir}/a", 'Hello world!')
+        File.write("#{dir}/b", 'Hello again!')
+        `#{EXEC} #{dir}/a #{dir}/b`
+        File.write("#{dir}/bad.#{EXT_NAME}", 'Hi')
+
+        files = %w[a bad b].map { |x| "#{dir}/#{x}.#{EXT_NAME}" }.join(' ')
+        out, err, stat = Open3.capture3("#{EXEC} -d -T#{count} #{files}")
+        assert_equal(1, stat.exitstatus)
+        assert(out.empty?)
+        assert_equal("#{APP_NAME}: '#{dir}/bad.#{EXT_NAME}' not in #{APP_NAME} format\n", err)
+        assert_equal('Hello world!', File.read("#{dir}/a"))
+        assert_equal('Hello again!', File.read("#{dir}/b"))
+      end
+    end
+  end
 end
@@ -0,0 +1,84 @@
+# frozen_string_literal: true
+
+require_relative 'global'
+require 'tmpdir'
+
+class DictionaryTest < Test::Unit::TestCase
+  def record(i)
+    %({"id": #{i}, "name": "user#{i * 37 % 101}", "email": "user#{i}@example.com", ) +
+      %("status": "#{%w[active inactive pending][i % 3]}", "roles": ["reader", "writer"]}\n)
+  end
+
+  def with_dictionary
+    Dir.mktmpdir do |dir|
+      200.times { |i| File.write("#{dir}/sample#{i}.json", record(i)) }
+      out, err, stat = Open3.capture3("#{EXEC} --train -o #{dir}/records.dict #{dir}/sample*.json")
+      assert(stat.success?)
+      assert(err.empty?)
+      assert(out.empty?)
+
+      yield dir
+    end
+  end
+
+  def test_small_file_with_dictionary
+    with_dictionary do |dir|
+      data = record(1000)
+      File.write("#{dir}/a.json", data)
+
+      plain = `#{EXEC} -c #{dir}/a.json`
+      out, err, stat = Open3.capture3("#{EXEC} -k --dict=#{dir}/records.dict #{dir}/a.json")
+      assert(stat.success?)
+      assert(err.empty?)
+      assert(out.empty?)
+      assert(File.size("#{dir}/a.json.#{EXT_NAME}") * 2 < plain.size)
+
+      out, err, stat = Open3.capture3("#{EXEC} -d -c --dict #{dir}/records.dict #{dir}/a.json.#{EXT_NAME}")
+      assert(stat.success?)
+      assert(err.empty?)
+      assert_equal(data, out)
+    end
+  end
+
+  def test_blocks_with_dictionary
+    with_dictionary do |dir|
+      data = Array.new(5000) { |i| record(i) }.join
+      File.write("#{dir}/a.json", data)
+
+      `#{EXEC} --block=16 --dict=#{dir}/records.dict #{dir}/a.json`
+      out, err, stat = Open3.capture3("#{EXEC} -d -c -T 4 --dict=#{dir}/records.dict #{dir}/a.json.#{EXT_NAME}")
+      assert(stat.success?)
+      assert(err.empty?)
+      assert_equal(data, out)
+
+      out, = Open3.capture3("#{EXEC} -d --range=70000:100 --dict=#{dir}/records.dict #{dir}/a.json.#{EXT_NAME}")
+      assert_equal(data[70_000, 100], out)
+    end
+  end
+
+  def test_dictionary_needed
+    with_dictionary do |dir|
+      File.write("#{dir}/a.json", record(1000))
+      `#{EXEC} --dict=#{dir}/records.dict #{dir}/a.json`
+
+      id = File.binread("#{dir}/records.dict", 4, 4).unpack1('V')
+      out, err, stat = Open3.capture3("#{EXEC} -d #{dir}/a.json.#{EXT_NAME}")
+      assert_equal(1, stat.exitstatus)
+      assert(out.empty?)
+      assert_equal(format("#{APP_NAME}: '#{dir}/a.json.#{EXT_NAME}' needs dictionary %08x\n", id), err)
+      assert_false File.exist?("#{dir}/a.json")
+    end
+  end
+
+  def test_not_a_dictionary
+    Tempfile.create do |file|
+      file.write('not a dictionary')
+      file.close
+
+      out, err, stat = Open3.capture3("#{EXEC} -c --dict=#{file.path}", stdin_data: 'data')
+      assert_false(stat.success?)
+      assert(out.empty?)
+      assert_equal("#{APP_NAME}: '#{file.path}' not a dictionary\n", err)
+    end
+  end
+end
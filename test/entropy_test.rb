@@ -0,0 +1,66 @@
+# frozen_string_literal: true
+
+require_relative 'global'
+
+class EntropyTest < Test::Unit::TestCase
+  ENTROPY_CODED = 0x80
+  SPLIT_SECTIONS = 0x40
+
+  def record(i)
+    "#{i} user=#{i * 7919 % 1000} action=#{%w[get put delete][i % 3]}\n"
+  end
+
+  def test_text_split_in_sections
+    data = Array.new(4000) { |i| record(i) }.join
+    compressed, = Open3.capture2(EXEC, stdin_data: data, binmode: true)
+    assert_equal(SPLIT_SECTIONS, compressed.getbyte(3) & (ENTROPY_CODED | SPLIT_SECTIONS))
+    assert_equal(20, compressed.getbyte(3) & ~(ENTROPY_CODED | SPLIT_SECTIONS))
+
+    out, err, stat = Open3.capture3("#{EXEC} -d", stdin_data: compressed, binmode: true)
+    assert(stat.success?)
+    assert(err.empty?)
+    assert_equal(data, out)
+  end
+
+  # a small stream can't afford a code table for every section
+  def test_small_text_coded_whole
+    data = Array.new(28) { |i| record(i) }.join
+    compressed, = Open3.capture2(EXEC, stdin_data: data, binmode: true)
+    assert_equal(ENTROPY_CODED, compressed.getbyte(3) & (ENTROPY_CODED | SPLIT_SECTIONS))
+
+    out, = Open3.capture2("#{EXEC} -d", stdin_data: compressed, binmode: true)
+    assert_equal(data, out)
+  end
+
+  def test_random_bytes_not_entropy_coded
+    data = Random.new(7).bytes(20_000)
+    compressed, = Open3.capture2(EXEC, stdin_data: data, binmode: true)
+    assert_equal(0, compressed.getbyte(3) & (ENTROPY_CODED | SPLIT_SECTIONS))
+
+    out, = Open3.capture2("#{EXEC} -d", stdin_data: compressed, binmode: true)
+    assert_equal(data, out)
+  end
+
+  def test_blocks_split_in_sections
+    data = Array.new(30_000) { |i| "#{i % 13},#{i * 31 % 977},#{i.odd? ? 'yes' : 'no'}\n" }.join
+    tmp = Tempfile.new.tap { |x| x.write(data) }.tap(&:close).path
+    compressed = `#{EXEC} -9 --block=16 -c #{tmp}`
+
+    # the window log of the first block follows the file header and the block's lengths
+    assert_equal(SPLIT_SECTIONS, compressed.getbyte(3 + 8 + 3) & SPLIT_SECTIONS)
+
+    out, stat = Open3.capture2("#{EXEC} -d -T 4", stdin_data: compressed, binmode: true)
+    assert(stat.success?)
+    assert_equal(data, out)
+  end
+
+  def test_corrupted_section
+    data = Array.new(4000) { |i| record(i) }.join
+    compressed, = Open3.capture2(EXEC, stdin_data: data, binmode: true)
+
+    out, err, stat = Open3.capture3("#{EXEC} -d", stdin_data: compressed[0, compressed.size / 2], binmode: true)
+    assert_equal(1, stat.exitstatus)
+    assert(out.empty?)
+    assert_equal("#{APP_NAME}: stdin not in #{APP_NAME} format\n", err)
+  end
+end
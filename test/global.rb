@@ -6,7 +6,13 @@ require 'open3'
 
 APP_NAME = 'bczip'
 EXT_NAME = 'bc'
-MAGIC_HEADER = 0xBC09
+MAGIC_HEADER = 0xBC0A
+MAGIC_HEADER_BLOCKS = 0xBC0B
 
 Dir.chdir __dir__
 EXEC = '../target/' + APP_NAME
+
+# log lines that fill a few blocks of 2^16 bytes, with --block=16
+BLOCKS_DATA = Array.new(3000) do |i|
+  "#{i} worker-#{i % 5} request id=#{i * 7919 % 100_000} status=#{i % 3 * 100 + 200}\n"
+end.join
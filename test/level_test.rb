@@ -0,0 +1,55 @@
+# frozen_string_literal: true
+
+require_relative 'global'
+
+class LevelTest < Test::Unit::TestCase
+  def test_levels
+    data = Array.new(2000) { |i| "#{i % 7} request id=#{i * 37 % 1000} status=#{i.even? ? 200 : 404}\n" }.join
+    tmp = Tempfile.new.tap { |x| x.write(data) }.tap(&:close).path
+
+    fast = `#{EXEC} -1 -c #{tmp}`
+    default = `#{EXEC} -c #{tmp}`
+    best = `#{EXEC} -9 -c #{tmp}`
+    assert(default.size <= fast.size)
+    assert(best.size <= default.size)
+
+    assert_equal(fast, `#{EXEC} --fast -c #{tmp}`)
+    assert_equal(default, `#{EXEC} -6 -c #{tmp}`)
+    assert_equal(best, `#{EXEC} --best -c #{tmp}`)
+    assert_equal(best, `#{EXEC} -9 -T 4 -c #{tmp}`)
+
+    [fast, default, best].each do |compressed|
+      out, err, stat = Open3.capture3("#{EXEC} -d", stdin_data: compressed)
+      assert(stat.success?)
+      assert(err.empty?)
+      assert_equal(data, out)
+    end
+  end
+
+  def test_levels_long_runs
+    data = "\0" * 100_000 + 'abc' * 20_000 + (0...256).map(&:chr).join * 40
+    tmp = Tempfile.new.tap { |x| x.binmode.write(data) }.tap(&:close).path
+
+    (1..9).each do |level|
+      out, err, stat = Open3.capture3("#{EXEC} -#{level} -c #{tmp} | #{EXEC} -d")
+      assert(stat.success?)
+      assert(err.empty?)
+      assert_equal(data.b, out.b)
+    end
+  end
+
+  def test_levels_repetitive_lines
+    data = "hello world line\n" * 12_000
+    tmp = Tempfile.new.tap { |x| x.write(data) }.tap(&:close).path
+
+    (1..9).each do |level|
+      compressed = `#{EXEC} -#{level} -c #{tmp}`
+      assert(compressed.size < 400)
+
+      out, err, stat = Open3.capture3("#{EXEC} -d", stdin_data: compressed)
+      assert(stat.success?)
+      assert(err.empty?)
+      assert_equal(data, out)
+    end
+  end
+end
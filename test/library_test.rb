@@ -0,0 +1,116 @@
+# frozen_string_literal: true
+
+require_relative 'global'
+
+class LibraryTest < Test::Unit::TestCase
+  PROGRAM = <<~C
+    #include "bczip.h"
+    #include <stdlib.h>
+    #include <string.h>
+
+    typedef struct { const uint8_t *data; size_t size; size_t offset; FILE *output; } pipe_state;
+
+    static size_t pipe_read(void *user_data, uint8_t *data, size_t size)
+    {
+      pipe_state *const s = user_data;
+      if (size > s->size - s->offset) { size = s->size - s->offset; }
+      if (size > 1000) { size = 1000; }
+
+      memcpy(data, s->data + s->offset, size);
+      s->offset += size;
+      return size;
+    }
+
+    static size_t pipe_write(void *user_data, const uint8_t *data, size_t size)
+    {
+      return fwrite(data, 1, size, ((pipe_state *)user_data)->output);
+    }
+
+    int main(void)
+    {
+      uint8_t *const input = malloc(300000);
+      for (uint32_t i = 0; i < 300000; ++i) {
+        input[i] = "0123456789,abc\\n"[(i * 7 + i / 100) % 15];
+      }
+
+      const bczip_compress_settings settings = {16, 16, 2};
+      bczip_ctx *const a = bczip_create_ctx(&settings);
+      bczip_ctx *const b = bczip_create_ctx(&settings);
+
+      // contexts are independent and reusable
+      size_t first_size, second_size, output_size;
+      uint8_t *const first = bczip_compress_buffer(a, input, 300000, &first_size);
+      uint8_t *const second = bczip_compress_buffer(b, input, 300000, &second_size);
+      uint8_t *const again = bczip_compress_buffer(a, input, 300000, &output_size);
+      if (first_size != second_size || first_size != output_size || memcmp(first, again, first_size)) { return 1; }
+
+      uint8_t *const output = bczip_decompress_buffer(b, first, first_size, &output_size);
+      if (output_size != 300000 || memcmp(input, output, output_size)) { return 2; }
+
+      if (bczip_decompress_buffer(a, input, 100, &output_size)) { return 3; }
+
+      size_t empty_size;
+      uint8_t *const empty = bczip_compress_buffer(a, input, 0, &empty_size);
+      uint8_t *const nothing = bczip_decompress_buffer(a, empty, empty_size, &output_size);
+      if (!nothing || output_size) { return 4; }
+
+      // the callbacks stream the compressed data to stdout
+      pipe_state state = {input, 300000, 0, stdout};
+      bczip_compress_stream(a, pipe_read, pipe_write, &state);
+
+      free(nothing);
+      free(empty);
+      free(output);
+      free(again);
+      free(second);
+      free(first);
+      free(input);
+
+      bczip_delete_ctx(b);
+      bczip_delete_ctx(a);
+      return 0;
+    }
+  C
+
+  def build(library)
+    source = Tempfile.new(['library', '.c']).tap { |x| x.write(PROGRAM) }.tap(&:close).path
+    program = source.sub(/\.c\z/, '')
+
+    _, err, stat = Open3.capture3("gcc -pthread -I../src #{source} #{library} -o #{program}")
+    assert(stat.success?, err)
+    yield program
+  ensure
+    File.delete(program) if File.exist?(program)
+  end
+
+  def test_static_library
+    build('../target/libbczip.a') do |program|
+      compressed, stat = Open3.capture2(program, binmode: true)
+      assert(stat.success?)
+
+      fb, sb = compressed.bytes
+      assert_equal(MAGIC_HEADER_BLOCKS, (fb << 8) + (sb & 0xF))
+
+      out, stat = Open3.capture2("#{EXEC} -d", stdin_data: compressed, binmode: true)
+      assert(stat.success?)
+      assert_equal(300_000, out.size)
+    end
+  end
+
+  # everything but the API is local to the static library, so programs can use the same names
+  def test_static_library_exports_only_its_api
+    out, stat = Open3.capture2('nm -g --defined-only ../target/libbczip.a')
+    assert(stat.success?)
+
+    names = out.lines.map { |line| line.split[2] }.compact
+    assert_include(names, 'bczip_create_ctx')
+    assert_equal([], names.reject { |name| name.start_with?('bczip_') })
+  end
+
+  def test_shared_library
+    build('-L../target -lbczip') do |program|
+      _, stat = Open3.capture2({ 'LD_LIBRARY_PATH' => '../target' }, program)
+      assert(stat.success?)
+    end
+  end
+end
@@ -0,0 +1,55 @@
+# frozen_string_literal: true
+
+require_relative 'global'
+require 'tmpdir'
+
+class OutputTest < Test::Unit::TestCase
+  DATA = Array.new(5000) { |i| "#{i} GET /items/#{i * 7 % 90} 200\n" }.join
+
+  def test_nothing_left_but_the_output
+    Dir.mktmpdir do |dir|
+      File.write("#{dir}/a.txt", DATA)
+      File.write("#{dir}/a.txt.#{EXT_NAME}", 'old')
+
+      out, err, stat = Open3.capture3("#{EXEC} -f #{dir}/a.txt")
+      assert(stat.success?)
+      assert(err.empty?)
+      assert(out.empty?)
+      assert_equal(["a.txt.#{EXT_NAME}"], Dir.children(dir))
+
+      _, _, stat = Open3.capture3("#{EXEC} -d #{dir}/a.txt.#{EXT_NAME}")
+      assert(stat.success?)
+      assert_equal(['a.txt'], Dir.children(dir))
+      assert_equal(DATA, File.read("#{dir}/a.txt"))
+    end
+  end
+
+  def test_mode_kept
+    Dir.mktmpdir do |dir|
+      File.write("#{dir}/a.txt", DATA)
+      File.chmod(0o640, "#{dir}/a.txt")
+
+      `#{EXEC} #{dir}/a.txt`
+      assert_equal(0o640, File.stat("#{dir}/a.txt.#{EXT_NAME}").mode & 0o777)
+
+      `#{EXEC} -d #{dir}/a.txt.#{EXT_NAME}`
+      assert_equal(0o640, File.stat("#{dir}/a.txt").mode & 0o777)
+    end
+  end
+
+  # the input is kept when its output can't be given its name
+  def test_output_not_written
+    Dir.mktmpdir do |dir|
+      File.write("#{dir}/a.txt", DATA)
+      Dir.mkdir("#{dir}/a.txt.#{EXT_NAME}")
+
+      out, err, stat = Open3.capture3("#{EXEC} -f #{dir}/a.txt")
+      assert_equal(1, stat.exitstatus)
+      assert(out.empty?)
+      assert_equal("#{APP_NAME}: '#{dir}/a.txt' can't write '#{dir}/a.txt.#{EXT_NAME}'\n", err)
+
+      assert_equal(%W[a.txt a.txt.#{EXT_NAME}], Dir.children(dir).sort)
+      assert_equal(DATA, File.read("#{dir}/a.txt"))
+    end
+  end
+end
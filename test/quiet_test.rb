@@ -5,7 +5,7 @@ require_relative 'global'
 class QuietTest < Test::Unit::TestCase
   def test_quiet_compress
     out, err, stat = Open3.capture3("#{EXEC} --quiet foo.txt bar.txt")
-    assert(stat.success?)
+    assert_equal(1, stat.exitstatus)
     assert(out.empty?)
     assert(err.empty?)
   end
@@ -14,7 +14,7 @@ class QuietTest < Test::Unit::TestCase
     tmp = Tempfile.new.tap { |x| x.write('Hello world!') }.tap(&:close).path
 
     out, err, stat = Open3.capture3("#{EXEC} -dq < #{tmp}")
-    assert(stat.success?)
+    assert_equal(1, stat.exitstatus)
     assert(out.empty?)
     assert(err.empty?)
 
@@ -0,0 +1,71 @@
+# frozen_string_literal: true
+
+require_relative 'global'
+
+class RangeTest < Test::Unit::TestCase
+  def test_range_of_blocks
+    tmp = Tempfile.new.tap { |x| x.write(BLOCKS_DATA) }.tap(&:close).path
+    `#{EXEC} --block=16 #{tmp}`
+
+    size = BLOCKS_DATA.size
+    [[0, 10], [65_530, 20], [100_000, 50_000], [size - 5, 100], [size + 5, 10]].each do |start, length|
+      out, err, stat = Open3.capture3("#{EXEC} -d --range #{start}:#{length} #{tmp}.#{EXT_NAME}")
+      assert(stat.success?)
+      assert(err.empty?)
+      assert_equal(BLOCKS_DATA[start, length].to_s, out)
+    end
+
+    assert File.exist?("#{tmp}.#{EXT_NAME}")
+    assert_false File.exist?(tmp)
+  end
+
+  def test_range_of_single_stream
+    compressed, = Open3.capture2(EXEC, stdin_data: 'Hello world!', binmode: true)
+
+    out, err, stat = Open3.capture3("#{EXEC} -d --range=6:5", stdin_data: compressed)
+    assert(stat.success?)
+    assert(err.empty?)
+    assert_equal('world', out)
+  end
+
+  def test_range_of_corrupted_block
+    tmp = Tempfile.new.tap { |x| x.write(BLOCKS_DATA) }.tap(&:close).path
+    compressed = `#{EXEC} --block=16 -c #{tmp}`.b
+    second_block = 3 + 8 + compressed.unpack1('@7V') + 8
+    64.times { |i| compressed.setbyte(second_block + 4 + i, 0) }
+    File.binwrite("#{tmp}.#{EXT_NAME}", compressed)
+
+    out, err, stat = Open3.capture3("#{EXEC} -d --range=10:20 #{tmp}.#{EXT_NAME}")
+    assert(stat.success?)
+    assert(err.empty?)
+    assert_equal(BLOCKS_DATA[10, 20], out)
+
+    out, err, stat = Open3.capture3("#{EXEC} -d --range=70000:20 #{tmp}.#{EXT_NAME}")
+    assert_equal(1, stat.exitstatus)
+    assert(out.empty?)
+    assert_equal("#{APP_NAME}: '#{tmp}.#{EXT_NAME}' not in #{APP_NAME} format\n", err)
+
+    out, err, stat = Open3.capture3("#{EXEC} -d --range=70000:20", stdin_data: compressed, binmode: true)
+    assert_equal(1, stat.exitstatus)
+    assert(out.empty?)
+    assert_equal("#{APP_NAME}: stdin not in #{APP_NAME} format\n", err)
+  end
+
+  def test_index_footer
+    tmp = Tempfile.new.tap { |x| x.write(BLOCKS_DATA) }.tap(&:close).path
+
+    compressed = `#{EXEC} --block=16 -c #{tmp}`
+    blocks_count, magic = compressed[-8..-1].unpack('VV')
+    assert_equal((BLOCKS_DATA.size + 0xFFFF) / 0x10000, blocks_count)
+    assert_equal('BCIX', [magic].pack('V'))
+  end
+
+  def test_invalid_range
+    %w[x 10 10: :10 -1:5 1:2x].each do |range|
+      out, err, stat = Open3.capture3("#{EXEC} -d --range=#{range} foo.#{EXT_NAME}")
+      assert_false(stat.success?)
+      assert(out.empty?)
+      assert_equal("#{APP_NAME}: invalid range '#{range}'\n", err)
+    end
+  end
+end
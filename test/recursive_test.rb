@@ -0,0 +1,80 @@
+# frozen_string_literal: true
+
+require_relative 'global'
+require 'tmpdir'
+
+class RecursiveTest < Test::Unit::TestCase
+  FILES = {
+    'a.txt' => 'Hello!' * 40,
+    'logs/1.log' => Array.new(400) { |i| "#{i} GET /items/#{i * 7 % 90} 200\n" }.join,
+    'logs/2.log' => Array.new(30_000) { |i| "#{i} POST /users/#{i * 13 % 700} 201\n" }.join,
+    'logs/old/3.log' => 'x',
+    'data/empty' => ''
+  }.freeze
+
+  def test_recursive
+    Dir.mktmpdir do |dir|
+      FILES.each do |name, data|
+        FileUtils.mkdir_p(File.dirname("#{dir}/#{name}"))
+        File.write("#{dir}/#{name}", data)
+      end
+      File.write("#{dir}/done.#{EXT_NAME}", 'already compressed')
+
+      out, err, stat = Open3.capture3("#{EXEC} -rv -T 3 #{dir}")
+      assert(stat.success?)
+      assert(err.empty?)
+
+      # messages come in the order of the paths, whichever file is done first
+      names = out.lines.grep(/replaced/).map { |x| x[/'#{dir}\/([^']*)'/, 1] }
+      assert_equal(FILES.keys.sort, names)
+
+      FILES.each_key do |name|
+        assert_false(File.exist?("#{dir}/#{name}"))
+        assert(File.exist?("#{dir}/#{name}.#{EXT_NAME}"))
+      end
+      assert_equal('already compressed', File.read("#{dir}/done.#{EXT_NAME}"))
+
+      out, err, stat = Open3.capture3("#{EXEC} -dr -T 2 #{dir}")
+      assert_equal(1, stat.exitstatus)
+      assert(out.empty?)
+      assert_equal("#{APP_NAME}: '#{dir}/done.#{EXT_NAME}' not in #{APP_NAME} format\n", err)
+
+      FILES.each { |name, data| assert_equal(data, File.read("#{dir}/#{name}")) }
+    end
+  end
+
+  def test_same_output_for_any_threads_count
+    Dir.mktmpdir do |dir|
+      FILES.each do |name, data|
+        FileUtils.mkdir_p(File.dirname("#{dir}/#{name}"))
+        File.write("#{dir}/#{name}", data)
+      end
+
+      expected = `#{EXEC} -rc #{dir}`
+      assert_equal(expected, `#{EXEC} -rc -T 4 #{dir}`)
+      assert_equal(expected, `#{EXEC} -c -T 2 #{FILES.keys.sort.map { |x| "#{dir}/#{x}" }.join(' ')}`)
+    end
+  end
+
+  def test_directory_without_recursive
+    Dir.mktmpdir do |dir|
+      out, err, stat = Open3.capture3("#{EXEC} #{dir}")
+      assert_equal(1, stat.exitstatus)
+      assert(out.empty?)
+      assert_equal("#{APP_NAME}: '#{dir}' is a directory\n", err)
+    end
+  end
+
+  def test_parallel_files_not_overwritten
+    tmp = Tempfile.new.tap { |x| x.write('Hello!') }.tap(&:close).path
+    other = Tempfile.new.tap { |x| x.write('World!') }.tap(&:close).path
+    File.write("#{tmp}.#{EXT_NAME}", 'kept')
+
+    out, err, stat = Open3.capture3("#{EXEC} -T 2 -k #{tmp} #{other}")
+    assert(stat.success?)
+    assert(err.empty?)
+    assert_equal("#{APP_NAME}: '#{tmp}.#{EXT_NAME}' already exists;\tnot overwritten\n", out)
+    assert_equal('kept', File.read("#{tmp}.#{EXT_NAME}"))
+    assert(File.exist?("#{other}.#{EXT_NAME}"))
+  end
+end
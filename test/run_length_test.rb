@@ -0,0 +1,42 @@
+# frozen_string_literal: true
+
+require_relative 'global'
+
+class RunLengthTest < Test::Unit::TestCase
+  # runs of every kind the kernels count, of every length up to past two AVX2 vectors, each
+  # broken by a random byte, so that every vector width and the bytes left after it are hit
+  # by whichever kernel the processor runs
+  def runs_data
+    random = Random.new(7)
+    steps = [->(x) { x }, ->(x) { (x + 3) & 0xFF }, ->(x) { ((x << 1) | (x >> 7)) & 0xFF },
+             ->(x) { ((x >> 1) | (x << 7)) & 0xFF }]
+
+    (1..80).map do |length|
+      start = random.rand(1..255)
+      steps.map do |step|
+        run = [start]
+        run << step.call(run.last) while run.size < length
+        (run + [random.rand(256)]).pack('C*')
+      end.join
+    end.join
+  end
+
+  def test_runs
+    data = runs_data
+    tmp = Tempfile.new.tap { |x| x.binmode.write(data) }.tap(&:close).path
+
+    [1, 6, 9].each do |level|
+      compressed, err, stat = Open3.capture3("#{EXEC} -#{level} --stats -c #{tmp}", binmode: true)
+      assert(stat.success?)
+
+      tokens = %w[repeat-byte-long arithmetic-progression shift-left shift-right]
+      tokens = tokens.first(1) if level == 1
+      tokens.each { |token| assert(err[/^  #{token} +\d+ +(\d+)/, 1].to_i > 0, "#{token} at -#{level}") }
+
+      out, err, stat = Open3.capture3("#{EXEC} -d", stdin_data: compressed, binmode: true)
+      assert(stat.success?)
+      assert(err.empty?)
+      assert_equal(data.b, out.b)
+    end
+  end
+end
@@ -0,0 +1,46 @@
+# frozen_string_literal: true
+
+require_relative 'global'
+
+class StatsTest < Test::Unit::TestCase
+  def test_stats
+    data = Array.new(3000) { |i| "#{i % 9} id=#{i * 41 % 997} #{'=' * (i % 5)}\n" }.join
+    tmp = Tempfile.new.tap { |x| x.write(data) }.tap(&:close).path
+
+    compressed, err, stat = Open3.capture3("#{EXEC} --stats -c #{tmp}")
+    assert(stat.success?)
+    assert(err.start_with?("#{APP_NAME}: '#{tmp}'\tstats:\n"))
+    compress_tokens = tokens(err)
+    assert_match(/^  parse +\d+\.\d+s$/, err)
+
+    # every byte after the 4-byte header is a token's, unless the tokens were entropy coded,
+    # every input byte is covered by one
+    coded, uncoded = err[/^  entropy coded bytes +(\d+) \(from (\d+) bytes\)$/].scan(/\d+/).map(&:to_i)
+    assert(coded < uncoded)
+    assert_equal(compressed.size - 4, compress_tokens.values.sum { |x| x[3] } - uncoded + coded)
+    assert_equal(data.size, compress_tokens.values.sum { |x| x[2] })
+    assert(compress_tokens['back-reference'][0] > 0)
+    assert_equal(0, compress_tokens['skip'][0])
+
+    out, err, stat = Open3.capture3("#{EXEC} --stats -d", stdin_data: compressed)
+    assert(stat.success?)
+    assert_equal(data, out)
+    assert(err.start_with?("#{APP_NAME}: 'stdin'\tstats:\n"))
+    assert_match(/^  decode tokens +\d+\.\d+s$/, err)
+
+    decompress_tokens = tokens(err)
+    compress_tokens.each do |name, (_, count, covered)|
+      next if count.zero?
+
+      assert_equal([count, covered], decompress_tokens[name], name)
+    end
+  end
+
+  private
+
+  # the numbers of every token row, by token name
+  def tokens(stats)
+    stats.lines.map(&:split).select { |x| x.size > 2 && x[1..-1].all? { |n| n =~ /\A\d+\z/ } }
+         .map { |name, *numbers| [name, numbers.map(&:to_i)] }.to_h
+  end
+end
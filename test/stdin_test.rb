@@ -16,6 +16,29 @@ class StdinTest < Test::Unit::TestCase
     assert_equal(MAGIC_HEADER, (out.bytes[0] << 8) + (out.bytes[1] & 0xF))
   end
 
+  def test_stdin_compress_streams_blocks
+    block = Array.new(6000) { |i| "#{i},#{i * 7 % 13}\n" }.join[0, 0x10000]
+
+    Open3.popen3("#{EXEC} --block=16") do |stdin, stdout, _stderr, wait_thr|
+      stdin.binmode.write(block * 2)
+      stdin.flush
+
+      # the first block is written while stdin is still open
+      assert_not_nil(IO.select([stdout], nil, nil, 10))
+      head = stdout.binmode.readpartial(3)
+      assert_equal(MAGIC_HEADER_BLOCKS, (head.bytes[0] << 8) + (head.bytes[1] & 0xF))
+
+      stdin.write(block)
+      stdin.close
+      compressed = head + stdout.read
+      assert(wait_thr.value.success?)
+
+      out, stat = Open3.capture2("#{EXEC} -d", stdin_data: compressed, binmode: true)
+      assert(stat.success?)
+      assert_equal(block * 3, out)
+    end
+  end
+
   def test_stdin_decompress
     tmp = Tempfile.new.tap { |x| x.write('Hello world!') }.tap(&:close).path
 
@@ -30,6 +53,27 @@ class StdinTest < Test::Unit::TestCase
     assert_equal('Hello world!', out)
   end
 
+  def test_stdin_decompress_streams_blocks
+    data = Array.new(20_000) { |i| "#{i},#{i * 7 % 13}\n" }.join
+    compressed, = Open3.capture2("#{EXEC} --block=16", stdin_data: data, binmode: true)
+    first_frame_end = 3 + 8 + compressed[7, 4].unpack1('V')
+
+    Open3.popen3("#{EXEC} -d") do |stdin, stdout, _stderr, wait_thr|
+      stdin.binmode.write(compressed[0, first_frame_end])
+      stdin.flush
+
+      # the first block is decoded while stdin is still open
+      assert_not_nil(IO.select([stdout], nil, nil, 10))
+      out = stdout.binmode.readpartial(0x10000)
+
+      stdin.write(compressed[first_frame_end..-1])
+      stdin.close
+      out += stdout.read
+      assert(wait_thr.value.success?)
+      assert_equal(data, out)
+    end
+  end
+
   def test_with_files
     tmp = Tempfile.new.tap { |x| x.write('Hello world!') }.tap(&:close).path
 
@@ -0,0 +1,127 @@
+# frozen_string_literal: true
+
+require_relative 'global'
+require 'tmpdir'
+
+class ThreadsTest < Test::Unit::TestCase
+  def test_blocks
+    tmp = Tempfile.new.tap { |x| x.write(BLOCKS_DATA) }.tap(&:close).path
+
+    compressed = `#{EXEC} --block=16 -T 3 -c #{tmp}`
+    fb, sb = compressed.bytes
+    assert_equal(MAGIC_HEADER_BLOCKS, (fb << 8) + (sb & 0xF))
+
+    out, err, stat = Open3.capture3("#{EXEC} -d", stdin_data: compressed)
+    assert(stat.success?)
+    assert(err.empty?)
+    assert_equal(BLOCKS_DATA, out)
+  end
+
+  def test_decompress_blocks_in_parallel
+    tmp = Tempfile.new.tap { |x| x.write(BLOCKS_DATA) }.tap(&:close).path
+
+    `#{EXEC} --block=16 #{tmp}`
+    out, err, stat = Open3.capture3("#{EXEC} -d -T 3 #{tmp}.#{EXT_NAME}")
+    assert(stat.success?)
+    assert(out.empty?)
+    assert(err.empty?)
+    assert_equal(BLOCKS_DATA, File.read(tmp))
+
+    out, err, stat = Open3.capture3("#{EXEC} -T 3 --block=16 -c #{tmp} | #{EXEC} -dc -T 2")
+    assert(stat.success?)
+    assert(err.empty?)
+    assert_equal(BLOCKS_DATA, out)
+  end
+
+  def test_same_output_for_any_threads_count
+    tmp = Tempfile.new.tap { |x| x.write(BLOCKS_DATA) }.tap(&:close).path
+
+    expected = `#{EXEC} --block=16 -c #{tmp}`
+    assert_equal(expected, `#{EXEC} --block=16 -cT2 #{tmp}`)
+    assert_equal(expected, `#{EXEC} --block=16 --threads=4 -c #{tmp}`)
+    assert_equal(expected, `#{EXEC} --block=16 -T0 -c #{tmp}`)
+  end
+
+  # the items of the dictionary are compressed by as many tasks as there are threads
+  def test_same_dictionary_for_any_threads_count
+    random = Random.new(2)
+    words = Array.new(400) { Array.new(3 + random.rand(10)) { (97 + random.rand(26)).chr }.join }
+    data = Array.new(15_000) { words[random.rand(words.size)] }.join(' ')
+    tmp = Tempfile.new.tap { |x| x.write(data) }.tap(&:close).path
+
+    expected = `#{EXEC} -9 -T1 -c #{tmp}`
+    assert(expected.unpack1('@1v') >> 4 > 0)
+    assert_equal(expected, `#{EXEC} -9 -T8 -c #{tmp}`)
+  end
+
+  # a corrupted block fails the whole file whether the blocks are decoded in parallel or not:
+  # the second one has the start of its data, after its stream header, zeroed
+  def test_corrupted_block_for_any_threads_count
+    tmp = Tempfile.new.tap { |x| x.write(BLOCKS_DATA) }.tap(&:close).path
+    compressed = `#{EXEC} --block=16 -c #{tmp}`.b
+    second_block = 3 + 8 + compressed.unpack1('@7V') + 8
+    64.times { |i| compressed.setbyte(second_block + 4 + i, 0) }
+
+    Dir.mktmpdir do |dir|
+      File.binwrite("#{dir}/victim.#{EXT_NAME}", compressed)
+      %w[1 4].each do |count|
+        out, err, stat = Open3.capture3("#{EXEC} -d -T#{count} #{dir}/victim.#{EXT_NAME}")
+        assert_false(stat.success?)
+        assert(out.empty?)
+        assert_equal("#{APP_NAME}: '#{dir}/victim.#{EXT_NAME}' not in #{APP_NAME} format\n", err)
+        assert_equal(compressed, File.binread("#{dir}/victim.#{EXT_NAME}"))
+        assert_false File.exist?("#{dir}/victim")
+      end
+    end
+  end
+
+  # an index entry giving a block longer than the file is refused before room is made for it, which the limit on
+  # memory would make fail
+  def test_corrupted_index
+    tmp = Tempfile.new.tap { |x| x.write(BLOCKS_DATA) }.tap(&:close).path
+    compressed = `#{EXEC} --block=16 -c #{tmp}`.b
+    first_entry = compressed.size - 8 - compressed.unpack1("@#{compressed.size - 8}V") * 8
+    compressed[first_entry + 4, 4] = [0xFFFFFF00].pack('V')
+
+    Dir.mktmpdir do |dir|
+      File.binwrite("#{dir}/victim.#{EXT_NAME}", compressed)
+      ['-T4', '-T1 --range=10:20'].each do |options|
+        out, err, stat = Open3.capture3("ulimit -v 1000000; #{EXEC} -d #{options} #{dir}/victim.#{EXT_NAME}")
+        assert_equal(1, stat.exitstatus)
+        assert(out.empty?)
+        assert_equal("#{APP_NAME}: '#{dir}/victim.#{EXT_NAME}' not in #{APP_NAME} format\n", err)
+        assert_false File.exist?("#{dir}/victim")
+      end
+    end
+  end
+
+  def test_single_block
+    tmp = Tempfile.new.tap { |x| x.write('Hello world!') }.tap(&:close).path
+
+    fb, sb = `#{EXEC} -T 2 -c #{tmp}`.bytes
+    assert_equal(MAGIC_HEADER, (fb << 8) + (sb & 0xF))
+  end
+
+  def test_invalid_threads_count
+    %w[-1 257 x].each do |count|
+      out, err, stat = Open3.capture3("#{EXEC} --threads=#{count} foo.txt")
+      assert_false(stat.success?)
+      assert(out.empty?)
+      assert_equal("#{APP_NAME}: invalid thread count '#{count}'\n", err)
+    end
+  end
+
+  def test_missing_threads_count
+    out, err, stat = Open3.capture3("#{EXEC} -T")
+    assert_false(stat.success?)
+    assert(out.empty?)
+    assert_equal("#{APP_NAME}: option '-T' requires an argument\n", err)
+  end
+
+  def test_invalid_block_size
+    out, err, stat = Open3.capture3("#{EXEC} --block=15 foo.txt")
+    assert_false(stat.success?)
+    assert(out.empty?)
+    assert_equal("#{APP_NAME}: invalid block size '15'\n", err)
+  end
+end
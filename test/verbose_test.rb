@@ -9,7 +9,22 @@ class VerboseTest < Test::Unit::TestCase
     out, err, stat = Open3.capture3("#{EXEC} --verbose #{tmp}")
     assert(stat.success?)
     assert(err.empty?)
-    assert_equal("#{APP_NAME}: '#{tmp}'\t50.0% replaced with '#{tmp}.#{EXT_NAME}'\n", out)
+    assert_equal("#{APP_NAME}: '#{tmp}'\t54.2% replaced with '#{tmp}.#{EXT_NAME}'\n", out)
+  end
+
+  def test_verbose_checks
+    data = Array.new(20_000) { |i| "#{i % 13} GET /index.html?page=#{i * 31 % 500} 200\n" }.join
+    tmp = Tempfile.new.tap { |x| x.write(data) }.tap(&:close).path
+
+    out, err, stat = Open3.capture3("#{EXEC} -vk #{tmp}")
+    assert(stat.success?)
+    assert(err.empty?)
+    checks = out.lines.last
+    assert(checks.start_with?("#{APP_NAME}: '#{tmp}'\tchecks: "))
+    assert_match(/back-reference 100%/, checks)
+    assert_match(/ [1-9]\d?%/, checks)
+
+    assert_equal(data, `#{EXEC} -dc #{tmp}.#{EXT_NAME}`)
   end
 
   def test_verbose_decompress
@@ -19,6 +34,6 @@ class VerboseTest < Test::Unit::TestCase
     out, err, stat = Open3.capture3("#{EXEC} -dv #{tmp}.#{EXT_NAME}")
     assert(stat.success?)
     assert(err.empty?)
-    assert_equal("#{APP_NAME}: '#{tmp}.#{EXT_NAME}'\t25.0% replaced with '#{tmp}'\n", out)
+    assert_equal("#{APP_NAME}: '#{tmp}.#{EXT_NAME}'\t27.1% replaced with '#{tmp}'\n", out)
   end
 end
@@ -0,0 +1,37 @@
+# frozen_string_literal: true
+
+require_relative 'global'
+
+class WindowTest < Test::Unit::TestCase
+  def test_window
+    # records that only repeat further back than 2^10 bytes
+    random = Random.new(1)
+    data = Array.new(150) { "#{random.rand(7)} request id=#{random.rand(100_000)} status=#{[200, 404].sample(random: random)}\n" }.join * 4
+    tmp = Tempfile.new.tap { |x| x.write(data) }.tap(&:close).path
+
+    small = `#{EXEC} --window=10 -c #{tmp}`
+    large = `#{EXEC} --window=24 -c #{tmp}`
+    assert(large.size * 2 < small.size)
+
+    [small, large].each do |compressed|
+      out, err, stat = Open3.capture3("#{EXEC} -d", stdin_data: compressed)
+      assert(stat.success?)
+      assert(err.empty?)
+      assert_equal(data, out)
+    end
+  end
+
+  def test_window_header
+    tmp = Tempfile.new.tap { |x| x.write('Hello world!') }.tap(&:close).path
+    assert_equal(12, `#{EXEC} --window=12 -c #{tmp}`.bytes[3])
+  end
+
+  def test_invalid_window
+    %w[9 25 x 12x].each do |window|
+      out, err, stat = Open3.capture3("#{EXEC} --window=#{window} foo.txt")
+      assert_false(stat.success?)
+      assert(out.empty?)
+      assert_equal("#{APP_NAME}: invalid window '#{window}'\n", err)
+    end
+  end
+end